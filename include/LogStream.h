@@ -6,19 +6,169 @@
 
 #include "Logger.h"
 
-#include <sstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <string.h>
 
 namespace nijika {
 
+namespace util {
+
+/**
+ * Fix-sized output buffer with inline storage, so it never touches the heap.
+ * Data beyond the capacity is silently truncated.
+ * @thread-safety: unsafe.
+ */
+template <size_t SIZE> class InlineBuffer : Noncopyable {
+  public:
+    InlineBuffer() noexcept : bytes_(0) {}
+
+    /**
+     * Clear the data in the buffer.
+     */
+    void clear() noexcept { bytes_ = 0; }
+
+    /**
+     * @return: the size of data in the buffer.
+     */
+    size_t bytes() const noexcept { return bytes_; }
+
+    /**
+     * @return: the capacity of the buffer.
+     */
+    static constexpr size_t capacity() noexcept { return SIZE; }
+
+    /**
+     * @return: the size of empty space in the buffer.
+     */
+    size_t avail() const noexcept { return SIZE - bytes_; }
+
+    /**
+     * @return a pointer to the data in the buffer.(read-only)
+     */
+    const char *data() const noexcept { return buf_; }
+
+    /**
+     * @return: a pointer to the empty space, used for formatting in place.
+     */
+    char *current() noexcept { return buf_ + bytes_; }
+
+    /**
+     * Commits bytes written in place through current().
+     * @param len: number of bytes written.
+     */
+    void add(size_t len) noexcept { bytes_ += len; }
+
+    /**
+     * Drops the data beyond a size.
+     * @param len: size to keep, at most bytes().
+     */
+    void resize(size_t len) noexcept { bytes_ = len; }
+
+    /**
+     * Appends data to the buffer, truncating it if there is not enough space.
+     * @param data: pointer to the user data.
+     * @param len: size of the data.
+     */
+    void append(const char *data, size_t len) noexcept {
+        len = std::min(len, avail());
+        memcpy(buf_ + bytes_, data, len);
+        bytes_ += len;
+    }
+
+    /**
+     * @return: true if the buffer is empty.
+     */
+    bool empty() const noexcept { return bytes_ == 0; }
+
+  private:
+    char buf_[SIZE]; // Inline storage.
+    size_t bytes_;   // Size of data in the buffer.
+};
+
+} // namespace util
+
 namespace log {
 
+class NewLineBase;
+
+/**
+ * Key-value field of a structured log line, see kv.
+ */
+template <typename T> struct KeyValue {
+    std::string_view key;
+    const T &value;
+};
+
+/**
+ * Makes a key-value field, e.g. ls << kv("user", id) << kv("lat_us", t);
+ * Written as k=v in TEXT and LOGFMT lines, as "k":v in JSON lines.
+ * @param key: field name, a plain identifier.
+ * @param value: anything LogStream can write. Strings and other
+ * non-numeric values are quoted in LOGFMT and JSON lines.
+ */
+template <typename T>
+KeyValue<T> kv(std::string_view key, const T &value) noexcept {
+    return {key, value};
+}
+
+/**
+ * Integer written in 0x-prefixed lower case hexadecimal, see hex.
+ */
+struct Hex {
+    uint64_t value;
+};
+
+/**
+ * Makes a hexadecimal integer, e.g. ls << hex(flags); writes 0x1f.
+ * Negative integers are written as their two's complement.
+ * @param v: any integer or enum.
+ */
+template <typename T> Hex hex(T v) noexcept {
+    if constexpr (std::is_enum_v<T>) {
+        return {(uint64_t)(std::underlying_type_t<T>)v};
+    } else {
+        static_assert(std::is_integral_v<T>, "Not an integer.");
+        return {(uint64_t)(std::make_unsigned_t<T>)v};
+    }
+}
+
+/**
+ * Manipulator making the current line wait until it is on disk when it is
+ * flushed, whatever its level, e.g. ls << "paid " << id << durable;
+ * See Logger::set_durable_level.
+ */
+struct Durable {};
+inline constexpr Durable durable{};
+
+/**
+ * Count of the lines a rate limited call site suppressed before the
+ * current one, see NIJIKA_LOG_LIMITED. Written as [SUPPRESSED: n] in TEXT
+ * lines, as a suppressed=n field otherwise, and not at all when 0.
+ */
+struct Suppressed {
+    uint64_t count;
+};
+
 /**
  * C++ stream style log system front-end, used to construct
- * log line.
+ * log line. The line is built in an inline buffer, so no heap allocation
+ * happens per line. Lines longer than LINE_SIZE are truncated.
+ * In LOGFMT and JSON lines the message is escaped as it is appended, and
+ * key-value fields are kept aside until flush, so they follow the message.
+ * A field that does not fit is dropped rather than cut.
  * @thread-safety: unsafe.
  */
-class LogStream : public std::stringstream {
+class LogStream : Noncopyable {
   public:
+    static constexpr size_t LINE_SIZE = 4096; // Maximum line size.
+
     /**
      * Constructor.
      * @param level: log level.(DEBUG, INFO, TRACE, WARN, ERROR,
@@ -33,8 +183,187 @@ class LogStream : public std::stringstream {
      */
     void flush();
 
+    /**
+     * Appends bytes to the current line, escaped if they are inside a
+     * quoted LOGFMT or JSON string.
+     * @param data: pointer to the user data.
+     * @param len: size of the data.
+     */
+    LogStream &append(const char *data, size_t len) {
+        if (escape_) {
+            return append_escaped(data, len);
+        }
+        size_t n = std::min(len, room());
+        cut_ = cut_ || n < len;
+        buf_.append(data, n);
+        return *this;
+    }
+
+    /**
+     * Ends the header of a LOGFMT or JSON line, which must leave the
+     * quoted message open, e.g. with msg=" or "msg":". Until flush, text
+     * is escaped into the message, and flush closes the message, adds the
+     * key-value fields and, for JSON, the closing brace. Called by NewLine,
+     * custom NewLine classes writing such headers call it too.
+     * @param format: layout of the line.
+     */
+    void begin_message(Logger::line_format format) noexcept {
+        format_ = format;
+        escape_ = format != Logger::TEXT;
+    }
+
+    /**
+     * @return: a pointer to the current line.(read-only)
+     */
+    const char *data() const noexcept { return buf_.data(); }
+
+    /**
+     * @return: the size of the current line.
+     */
+    size_t size() const noexcept { return buf_.bytes(); }
+
+    LogStream &operator<<(bool v) { return append(v ? "1" : "0", 1); }
+    LogStream &operator<<(char v) { return append(&v, 1); }
+    LogStream &operator<<(signed char v) { return *this << (char)v; }
+    LogStream &operator<<(unsigned char v) { return *this << (char)v; }
+
+    LogStream &operator<<(short v);
+    LogStream &operator<<(unsigned short v);
+    LogStream &operator<<(int v);
+    LogStream &operator<<(unsigned int v);
+    LogStream &operator<<(long v);
+    LogStream &operator<<(unsigned long v);
+    LogStream &operator<<(long long v);
+    LogStream &operator<<(unsigned long long v);
+
+    LogStream &operator<<(float v);
+    LogStream &operator<<(double v);
+    LogStream &operator<<(long double v);
+
+    LogStream &operator<<(const void *p);
+    LogStream &operator<<(Hex v);
+
+    LogStream &operator<<(const char *s) {
+        return s ? append(s, strlen(s)) : append("(null)", 6);
+    }
+    LogStream &operator<<(std::string_view s) {
+        return append(s.data(), s.size());
+    }
+    LogStream &operator<<(const std::string &s) {
+        return append(s.data(), s.size());
+    }
+
+    LogStream &operator<<(const NewLineBase &nl);
+
+    LogStream &operator<<(Suppressed s);
+
+    LogStream &operator<<(Durable) {
+        durable_ = true;
+        return *this;
+    }
+
+    template <typename T> LogStream &operator<<(const KeyValue<T> &field) {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+            begin_field(field.key, false);
+            field.value ? append("true", 4) : append("false", 5);
+        } else if constexpr (std::is_floating_point_v<U>) {
+            // JSON has no inf or nan literals.
+            bool finite = field.value - field.value == 0;
+            begin_field(field.key, !finite);
+            *this << field.value;
+        } else if constexpr (std::is_arithmetic_v<U> &&
+                             !std::is_same_v<U, char> &&
+                             !std::is_same_v<U, signed char> &&
+                             !std::is_same_v<U, unsigned char>) {
+            begin_field(field.key, false);
+            *this << field.value;
+        } else {
+            begin_field(field.key, true);
+            *this << field.value;
+        }
+        end_field();
+        return *this;
+    }
+
+    /**
+     * Fallback for user types providing std::ostream insertion. Formats
+     * through std::ostream, so it is slower than the overloads above.
+     */
+    template <typename T,
+              typename = std::enable_if_t<
+                  !std::is_arithmetic_v<T> && !std::is_enum_v<T> &&
+                  !std::is_pointer_v<T> &&
+                  !std::is_convertible_v<const T &, std::string_view> &&
+                  !std::is_base_of_v<NewLineBase, T>>,
+              typename = decltype(std::declval<std::ostream &>()
+                                  << std::declval<const T &>())>
+    LogStream &operator<<(const T &v) {
+        std::ostream &os = begin_ostream();
+        os << v;
+        end_ostream();
+        return *this;
+    }
+
     Logger::level level;   // log level
     const std::string tid; // [TID]
+
+  private:
+    // Room for the closing '"', '}' and '\n'.
+    static constexpr size_t TAIL_SIZE = 3;
+
+    InlineBuffer<LINE_SIZE + TAIL_SIZE> buf_; // Current line.
+    InlineBuffer<LINE_SIZE> fields_;          // Key-value fields aside.
+    Logger::line_format format_;              // Layout of the line.
+    bool escape_;                             // Escaping appended text.
+    bool quoted_;                             // Field value is quoted.
+    bool cut_;                                // Field value was cut.
+    bool durable_;                            // Line waits for the disk.
+    size_t field_begin_;                      // Offset of the field.
+
+    /**
+     * @return: space left for the line, reserving the tail and the fields.
+     */
+    size_t room() const noexcept {
+        return buf_.avail() - TAIL_SIZE - fields_.bytes();
+    }
+
+    /**
+     * Appends as much escaped data as fits.
+     */
+    LogStream &append_escaped(const char *data, size_t len);
+
+    /**
+     * Starts a key-value field.
+     * @param key: name of the field.
+     * @param quoted: whether LOGFMT and JSON quote the value.
+     */
+    void begin_field(std::string_view key, bool quoted);
+
+    /**
+     * Ends a key-value field, moving it aside in LOGFMT and JSON lines.
+     */
+    void end_field();
+
+    /**
+     * Formats an integer in place.
+     */
+    template <typename T> LogStream &format_integer(T v);
+
+    /**
+     * Formats a floating point number in place, shortest round trip.
+     */
+    template <typename T> LogStream &format_float(T v);
+
+    /**
+     * Binds a thread local std::ostream to the free space of the line.
+     */
+    std::ostream &begin_ostream();
+
+    /**
+     * Commits bytes written through the std::ostream.
+     */
+    void end_ostream();
 };
 
 /**
@@ -49,29 +378,227 @@ class NewLineBase {
     virtual ~NewLineBase() = default;
 };
 
+/**
+ * Source location of a log call site, with the default
+ * "[FILE: ..][FUNC: ..][LINE: ..]" context rendered once, in every line
+ * format. Use NIJIKA_STATIC_SITE(SourceSite) to get one per call site.
+ */
+class SourceSite : Noncopyable {
+  public:
+    SourceSite(const char *file, const char *func, int line);
+
+    const char *file;
+    const char *func;
+    int line;
+
+    /**
+     * @param format: line format.
+     * @return: the pre-rendered context, [FILE][FUNC][LINE] for TEXT,
+     * " file=.. func=.. line=.." for LOGFMT, ',"file":..,"func":..,"line":..'
+     * for JSON.
+     */
+    std::string_view
+    context(Logger::line_format format = Logger::TEXT) const noexcept {
+        return contexts_[format];
+    }
+
+  private:
+    std::string contexts_[3]; // By line format.
+};
+
+/**
+ * Expands to a reference to a static T built once per call site from
+ * (__FILE__, __func__, __LINE__). Custom NewLine classes can use it with
+ * their own site type to pre-render their own context, e.g.
+ * #define mynewl MyNewLine(NIJIKA_STATIC_SITE(MySite))
+ */
+#define NIJIKA_STATIC_SITE(T)                                                  \
+    ([](const char *func) -> const T & {                                       \
+        static const T site(__FILE__, func, __LINE__);                         \
+        return site;                                                           \
+    }(__func__))
+
 /**
  * Default NewLine class used by LogStream.
  */
 class NewLine : public NewLineBase {
   public:
-    NewLine(const std::string &file, const std::string &func, int line);
+    /**
+     * Constructor, copies nothing but the timestamp.
+     * @param site: static call site, which must outlive the NewLine.
+     */
+    explicit NewLine(const SourceSite &site);
 
     LogStream &operator()(LogStream &ls) const;
 
   private:
-    std::string context_;
+    const SourceSite &site_;                // [FILE][FUNC][LINE]
+    char time_[TimestampFormatter::LENGTH]; // Timestamp of the line.
+};
+
+#define newl nijika::log::NewLine(NIJIKA_STATIC_SITE(nijika::log::SourceSite))
+
+/**
+ * Turns a stream expression into void, so the macros below stay a single
+ * expression and are safe inside if/else without braces.
+ */
+struct LogVoidify {
+    void operator&(const LogStream &) const noexcept {}
+};
+
+/**
+ * State of a rate limited call site, one static instance per site, see
+ * NIJIKA_LOG_LIMITED. Checks cost one or two relaxed atomic operations and
+ * run before the line is started, so suppressed lines are never formatted.
+ * Each check returns 0 to suppress the line, otherwise 1 plus the number of
+ * lines suppressed since the site last emitted one.
+ * @thread-safety: safe.
+ */
+class SiteLimiter : Noncopyable {
+  public:
+    constexpr SiteLimiter() noexcept : hits_(0), suppressed_(0), due_(0) {}
+
+    /**
+     * Passes hits 1, n + 1, 2n + 1...
+     */
+    uint64_t every_n(uint64_t n) noexcept {
+        uint64_t hit = hits_.fetch_add(1, std::memory_order_relaxed);
+        return pass(n <= 1 || hit % n == 0);
+    }
+
+    /**
+     * Passes the first n hits.
+     */
+    uint64_t first_n(uint64_t n) noexcept {
+        // Stops counting past n, so the counter never wraps around.
+        if (hits_.load(std::memory_order_relaxed) >= n) {
+            return pass(false);
+        }
+        return pass(hits_.fetch_add(1, std::memory_order_relaxed) < n);
+    }
+
+    /**
+     * Token bucket passing at most k hits per second, in bursts of up to k.
+     * Kept as the time the bucket is full again (GCRA), so a single
+     * compare-and-swap updates it.
+     */
+    uint64_t per_second(double k) noexcept {
+        if (k <= 0) {
+            return pass(false);
+        }
+
+        constexpr int64_t second = 1000000000;
+        int64_t interval = (int64_t)(second / k);
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+        int64_t due = due_.load(std::memory_order_relaxed);
+        int64_t next;
+        do {
+            next = std::max(due, now);
+            if (next - now > second - interval) {
+                return pass(false); // The bucket is empty.
+            }
+        } while (!due_.compare_exchange_weak(due, next + interval,
+                                             std::memory_order_relaxed));
+        return pass(true);
+    }
+
+    /**
+     * Passes each hit with probability p.
+     */
+    uint64_t sampled(double p) noexcept {
+        return pass(p >= 1 || (double)random() < p * 18446744073709551616.0);
+    }
+
+  private:
+    std::atomic<uint64_t> hits_;       // Checks of every_n and first_n.
+    std::atomic<uint64_t> suppressed_; // Since the last line emitted.
+    std::atomic<int64_t> due_;         // When the bucket is full again.
+
+    uint64_t pass(bool ok) noexcept {
+        if (!ok) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        // Read first, the exchange would dirty the cache line every time.
+        if (suppressed_.load(std::memory_order_relaxed) == 0) {
+            return 1;
+        }
+        return 1 + suppressed_.exchange(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return: a per-thread pseudo random number. (xorshift64*)
+     */
+    static uint64_t random() noexcept {
+        thread_local uint64_t state = 0;
+        if (state == 0) {
+            uint64_t now = std::chrono::steady_clock::now()
+                               .time_since_epoch()
+                               .count();
+            state = ((uint64_t)(uintptr_t)&state ^ now) | 1; // Never 0.
+        }
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dull;
+    }
 };
 
-#define newl nijika::log::NewLine(__FILE__, __func__, __LINE__)
+/**
+ * Statements below this level are compiled out. Define it before including
+ * this header, or on the command line. (0 DEBUG, 1 INFO, 2 TRACE, 3 WARN,
+ * 4 ERROR, 5 FATAL)
+ */
+#ifndef NIJIKA_LOG_MIN_LEVEL
+#define NIJIKA_LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * Starts a log line of the given level, e.g. NIJIKA_LOG_INFO << "x = " << x;
+ * Operands are not evaluated if the level is below NIJIKA_LOG_MIN_LEVEL or
+ * the runtime threshold of the Logger.
+ */
+#define NIJIKA_LOG(lvl)                                                        \
+    ((lvl) < NIJIKA_LOG_MIN_LEVEL || !nijika::log::Logger::enabled(lvl))       \
+        ? (void)0                                                              \
+        : nijika::log::LogVoidify() & nijika::log::LogStream(lvl) << newl
+
+#define NIJIKA_LOG_DEBUG NIJIKA_LOG(nijika::log::Logger::DEBUG)
+#define NIJIKA_LOG_INFO NIJIKA_LOG(nijika::log::Logger::INFO)
+#define NIJIKA_LOG_TRACE NIJIKA_LOG(nijika::log::Logger::TRACE)
+#define NIJIKA_LOG_WARN NIJIKA_LOG(nijika::log::Logger::WARN)
+#define NIJIKA_LOG_ERROR NIJIKA_LOG(nijika::log::Logger::ERROR)
+#define NIJIKA_LOG_FATAL NIJIKA_LOG(nijika::log::Logger::FATAL)
 
-LogStream &operator<<(LogStream &ls, const NewLineBase &nl);
+/**
+ * Rate limited NIJIKA_LOG(lvl), e.g.
+ * NIJIKA_LOG_EVERY_N(nijika::log::Logger::WARN, 1000) << "retrying";
+ * rule is a check of the static SiteLimiter of the call site. Lines it
+ * suppresses are counted, and reported by the next line the site emits.
+ * Unlike NIJIKA_LOG these are statements rather than expressions, still
+ * safe inside if/else without braces.
+ */
+#define NIJIKA_LOG_LIMITED(lvl, rule)                                          \
+    for (uint64_t nijika_pass_ =                                               \
+             ((lvl) < NIJIKA_LOG_MIN_LEVEL ||                                  \
+              !nijika::log::Logger::enabled(lvl))                              \
+                 ? 0                                                           \
+                 : ([]() -> nijika::log::SiteLimiter & {                       \
+                       static nijika::log::SiteLimiter limiter;                \
+                       return limiter;                                         \
+                   }())                                                        \
+                       .rule;                                                  \
+         nijika_pass_ != 0; nijika_pass_ = 0)                                  \
+    nijika::log::LogVoidify() & nijika::log::LogStream(lvl)                    \
+                                    << newl                                    \
+                                    << nijika::log::Suppressed{nijika_pass_ - 1}
 
-#define NIJIKA_LOG_DEBUG nijika::log::logstream(nijika::log::logger::DEBUG)
-#define NIJIKA_LOG_INFO nijika::log::logstream(nijika::log::logger::INFO)
-#define NIJIKA_LOG_TRACE nijika::log::logstream(nijika::log::logger::TRACE)
-#define NIJIKA_LOG_WARN nijika::log::logstream(nijika::log::logger::WARN)
-#define NIJIKA_LOG_ERROR nijika::log::logstream(nijika::log::logger::ERROR)
-#define NIJIKA_LOG_FATAL nijika::log::logstream(nijika::log::logger::FATAL)
+#define NIJIKA_LOG_EVERY_N(lvl, n) NIJIKA_LOG_LIMITED(lvl, every_n(n))
+#define NIJIKA_LOG_FIRST_N(lvl, n) NIJIKA_LOG_LIMITED(lvl, first_n(n))
+#define NIJIKA_LOG_PER_SECOND(lvl, k) NIJIKA_LOG_LIMITED(lvl, per_second(k))
+#define NIJIKA_LOG_SAMPLED(lvl, p) NIJIKA_LOG_LIMITED(lvl, sampled(p))
 
 } // namespace log
 
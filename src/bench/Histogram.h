@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <stdint.h>
+
+/**
+ * Log-linear latency histogram, in the style of HdrHistogram: values below
+ * 2^(SUB_BITS + 1) are exact, larger ones fall into one of 2^SUB_BITS
+ * linear buckets per power of two, so every recorded value is kept within
+ * 1% relative error over the whole uint64_t range.
+ * @thread-safety: unsafe, keep one per thread and merge.
+ */
+class Histogram {
+  public:
+    static constexpr int SUB_BITS = 7; // 128 buckets per power of two.
+
+    Histogram() : counts_(index(UINT64_MAX) + 1), count_(0), max_(0), sum_(0) {}
+
+    /**
+     * Records a value.
+     */
+    void record(uint64_t v) {
+        ++counts_[index(v)];
+        ++count_;
+        max_ = std::max(max_, v);
+        sum_ += v;
+    }
+
+    /**
+     * Adds the values recorded by another histogram.
+     */
+    void merge(const Histogram &other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    /**
+     * @param p: percentile, in [0, 100].
+     * @return: the highest value of the bucket holding the percentile, 0 if
+     * nothing was recorded.
+     */
+    uint64_t percentile(double p) const {
+        if (count_ == 0) {
+            return 0;
+        }
+
+        // Rank of the value, 1-based.
+        uint64_t rank = std::max<uint64_t>((uint64_t)(p / 100 * count_ + 0.5),
+                                           1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(highest(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t count() const noexcept { return count_; }
+
+    uint64_t max() const noexcept { return max_; }
+
+    double mean() const noexcept {
+        return count_ ? (double)sum_ / count_ : 0;
+    }
+
+  private:
+    static constexpr uint64_t EXACT = 1 << (SUB_BITS + 1);
+
+    std::vector<uint64_t> counts_;
+    uint64_t count_;
+    uint64_t max_;
+    uint64_t sum_;
+
+    static size_t index(uint64_t v) {
+        if (v < EXACT) {
+            return v;
+        }
+        // v has its highest bit at msb, keep the SUB_BITS bits after it.
+        int msb = 63 - __builtin_clzll(v);
+        int shift = msb - SUB_BITS;
+        return EXACT + (size_t)(msb - SUB_BITS - 1) * (1 << SUB_BITS) +
+               ((v >> shift) - (1 << SUB_BITS));
+    }
+
+    static uint64_t highest(size_t i) {
+        if (i < EXACT) {
+            return i;
+        }
+        int msb = (i - EXACT) / (1 << SUB_BITS) + SUB_BITS + 1;
+        int shift = msb - SUB_BITS;
+        uint64_t sub = (i - EXACT) % (1 << SUB_BITS) + (1 << SUB_BITS);
+        return ((sub + 1) << shift) - 1;
+    }
+};
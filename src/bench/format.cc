@@ -0,0 +1,193 @@
+#include "LogStream.h"
+#include "util/NumberFormat.h"
+
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace nijika::log;
+using namespace nijika::util;
+using namespace std::chrono;
+
+/**
+ * Microbenchmarks of the number formatting kernels against the iostream
+ * baseline, snprintf and std::to_chars, plus LogStream insertion, which
+ * adds its buffer handling to the kernels. Checks first that the kernels
+ * agree with std::to_chars.
+ *
+ * usage: nilog-bench-format [iterations]
+ */
+
+static const size_t VALUES = 4096; // Inputs cycled through.
+
+static volatile size_t sink; // Keeps the output alive.
+
+/**
+ * Runs a formatter over the inputs.
+ * @return: nanoseconds per value.
+ */
+template <typename T, typename F>
+static double measure(const std::vector<T> &values, int iterations, F f) {
+    size_t bytes = 0;
+    auto begin = steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const T &v : values) {
+            bytes += f(v);
+        }
+    }
+    auto end = steady_clock::now();
+    sink = bytes;
+    return (double)duration_cast<nanoseconds>(end - begin).count() /
+           ((double)iterations * values.size());
+}
+
+/**
+ * Measures every method on one type and prints a row for each.
+ */
+template <typename T>
+static void run(const char *type, const std::vector<T> &values,
+                int iterations, const char *printf_fmt) {
+    std::ostringstream os;
+    char buf[NumberFormat::MAX_SIZE];
+
+    // LogStream discards lines below the runtime threshold on flush.
+    Logger::get_instance().set_threshold(Logger::FATAL);
+    LogStream ls(Logger::DEBUG);
+
+    double iostream = measure(values, iterations, [&](const T &v) {
+        os.seekp(0);
+        if constexpr (std::is_pointer_v<T>) {
+            os << (const void *)v;
+        } else {
+            os << v;
+        }
+        return (size_t)os.tellp();
+    });
+    double snprintf_ns = measure(values, iterations, [&](const T &v) {
+        return (size_t)snprintf(buf, sizeof(buf), printf_fmt, v);
+    });
+    double to_chars = measure(values, iterations, [&](const T &v) {
+        if constexpr (std::is_pointer_v<T>) {
+            return (size_t)(std::to_chars(buf, buf + sizeof(buf),
+                                          (uintptr_t)v, 16)
+                                .ptr -
+                            buf);
+        } else {
+            return (size_t)(std::to_chars(buf, buf + sizeof(buf), v).ptr -
+                            buf);
+        }
+    });
+    double kernel = measure(values, iterations, [&](const T &v) {
+        if constexpr (std::is_pointer_v<T>) {
+            return (size_t)(NumberFormat::pointer(buf, (uintptr_t)v) - buf);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            return (size_t)(NumberFormat::floating(buf, v) - buf);
+        } else {
+            return (size_t)(NumberFormat::integer(buf, v) - buf);
+        }
+    });
+    size_t count = 0;
+    double logstream = measure(values, iterations, [&](const T &v) {
+        if constexpr (std::is_pointer_v<T>) {
+            ls << (const void *)v << ' ';
+        } else {
+            ls << v << ' ';
+        }
+        if (++count % 64 == 0) {
+            ls.flush();
+        }
+        return (size_t)1;
+    });
+
+    struct Row {
+        const char *method;
+        double ns;
+    } rows[] = {{"iostream", iostream},
+                {"snprintf", snprintf_ns},
+                {"to_chars", to_chars},
+                {"NumberFormat", kernel},
+                {"LogStream", logstream}};
+    for (auto &&row : rows) {
+        printf("%-8s %-13s %8.2f %8.2fx\n", type, row.method, row.ns,
+               iostream / row.ns);
+    }
+}
+
+/**
+ * Compares the kernels with std::to_chars.
+ * @return: false on the first mismatch.
+ */
+template <typename T> static bool check(const std::vector<T> &values) {
+    for (const T &v : values) {
+        char expect[NumberFormat::MAX_SIZE];
+        char got[NumberFormat::MAX_SIZE];
+        size_t expect_len;
+        size_t got_len;
+        if constexpr (std::is_floating_point_v<T>) {
+            expect_len = std::to_chars(expect, expect + sizeof(expect), v).ptr -
+                         expect;
+            got_len = NumberFormat::floating(got, v) - got;
+        } else {
+            expect_len = std::to_chars(expect, expect + sizeof(expect), v).ptr -
+                         expect;
+            got_len = NumberFormat::integer(got, v) - got;
+        }
+        if (expect_len != got_len || memcmp(expect, got, got_len)) {
+            fprintf(stderr, "mismatch: %.*s formatted as %.*s\n",
+                    (int)expect_len, expect, (int)got_len, got);
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000;
+
+    // Integers of every length, doubles of every magnitude.
+    std::mt19937_64 rng(42);
+    std::vector<int> ints;
+    std::vector<uint64_t> uints;
+    std::vector<int64_t> negs;
+    std::vector<double> doubles;
+    std::vector<const char *> pointers;
+    for (size_t i = 0; i < VALUES; ++i) {
+        uint64_t r = rng();
+        ints.push_back((int)(r >> (32 + rng() % 32)) * (r & 1 ? -1 : 1));
+        uints.push_back(r >> (rng() % 64));
+        negs.push_back(-(int64_t)(r >> (1 + rng() % 63)));
+        doubles.push_back(std::ldexp((double)(r >> 11) / (1ull << 53),
+                                     (int)(rng() % 200) - 100));
+        pointers.push_back((const char *)(uintptr_t)(r >> 16));
+    }
+    uints.push_back(0);
+    uints.push_back(UINT64_MAX);
+    negs.push_back(INT64_MIN);
+
+    if (!check(ints) || !check(uints) || !check(negs) || !check(doubles)) {
+        return 1;
+    }
+    for (uint64_t v = 1; v != 0 && v <= UINT64_MAX / 10; v *= 10) {
+        if (!check(std::vector<uint64_t>{v - 1, v, v + 1})) {
+            return 1;
+        }
+    }
+
+    printf("%-8s %-13s %8s %9s\n", "type", "method", "ns/value",
+           "speedup");
+    run("int", ints, iterations, "%d");
+    run("uint64", uints, iterations, "%lu");
+    run("int64", negs, iterations, "%ld");
+    run("double", doubles, iterations, "%g");
+    run("pointer", pointers, iterations, "%p");
+
+    return 0;
+}
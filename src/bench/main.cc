@@ -0,0 +1,412 @@
+#include "Histogram.h"
+#include "LogStream.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nijika::log;
+using namespace std::chrono;
+
+/**
+ * Benchmark suite. Sweeps thread count, line length, sync/async mode,
+ * buffer size and flush interval, and reports for every combination the
+ * throughput, the per-call latency percentiles and the bytes on disk, after
+ * checking that every line reached the files. Results are printed as JSON.
+ *
+ * Every run is a child process, since the logger can only be initialized
+ * once, writing into its own directory, which is emptied afterwards. The
+ * BLOCK policy with a long timeout makes a dropped line a failure.
+ */
+
+static const char *usage =
+    "usage: bench [options]\n"
+    "  -t list  thread counts, default 1,2,4,... up to the cores\n"
+    "  -l list  line lengths, i.e. the message after the line header,\n"
+    "           default 32,128,512\n"
+    "  -m list  modes among sync,shared,ring, default all\n"
+    "  -b list  buffer sizes, default 1048576,8388608\n"
+    "  -f list  flush intervals in seconds, default 3\n"
+    "  -n num   lines per thread, default 100000\n"
+    "  -p num   buffers of the pre-faulted buffer pool, default 0 (none)\n"
+    "  -d dir   directory of the log files, default ./nilog-bench/\n"
+    "  -o file  write the JSON to a file instead of stdout\n"
+    "  Exits with 1 if a run loses lines.\n";
+
+/**
+ * One combination of the sweep.
+ */
+struct Config {
+    std::string mode; // sync, shared or ring.
+    int threads;
+    size_t line_length;
+    size_t buffer_size;
+    long flush_interval;
+    int lines;   // Per thread.
+    size_t pool; // Pool buffers, 0 for none.
+};
+
+/**
+ * Outcome of the check of the written files.
+ */
+struct Check {
+    uint64_t lines = 0;      // Lines of the benchmark found.
+    uint64_t missing = 0;    // Lines never written.
+    uint64_t duplicates = 0; // Lines written more than once.
+    uint64_t bytes = 0;      // Bytes on disk.
+};
+
+static std::vector<long> parse_list(const char *arg) {
+    std::vector<long> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        values.push_back(atol(item.c_str()));
+    }
+    return values;
+}
+
+static std::vector<std::string> parse_names(const char *arg) {
+    std::vector<std::string> names;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        names.push_back(item);
+    }
+    return names;
+}
+
+/**
+ * Lists the regular files of a directory.
+ */
+static std::vector<std::string> list_files(const std::string &dir) {
+    std::vector<std::string> files;
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return files;
+    }
+    while (dirent *ent = readdir(d)) {
+        struct stat st;
+        std::string name = dir + ent->d_name;
+        if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            files.push_back(name);
+        }
+    }
+    closedir(d);
+    return files;
+}
+
+/**
+ * Producer thread: every line carries its thread and sequence numbers, so
+ * the check can find lost and duplicated lines.
+ */
+static void do_write(const Config &config, int id, Histogram &hist) {
+    std::string payload(config.line_length, 'x');
+    LogStream ls(Logger::INFO);
+
+    for (int i = 0; i < config.lines; ++i) {
+        auto begin = steady_clock::now();
+        ls << newl << "bench " << id << ' ' << i << ' ' << payload;
+        ls.flush();
+        auto end = steady_clock::now();
+        hist.record(duration_cast<nanoseconds>(end - begin).count());
+    }
+}
+
+/**
+ * Reads back the files and checks that every line arrived exactly once.
+ */
+static Check check_files(const std::string &dir, const Config &config) {
+    Check check;
+    std::vector<std::vector<uint8_t>> seen(
+        config.threads, std::vector<uint8_t>(config.lines, 0));
+
+    for (auto &&file : list_files(dir)) {
+        std::ifstream in(file, std::ios::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            check.bytes += line.size() + 1;
+
+            size_t pos = line.find("bench ");
+            if (pos == std::string::npos) {
+                continue;
+            }
+            char *end;
+            long id = strtol(line.c_str() + pos + 6, &end, 10);
+            long seq = strtol(end, nullptr, 10);
+            if (id < 0 || id >= config.threads || seq < 0 ||
+                seq >= config.lines) {
+                continue;
+            }
+
+            ++check.lines;
+            if (seen[id][seq]++) {
+                ++check.duplicates;
+            }
+        }
+    }
+
+    for (auto &&thread : seen) {
+        for (uint8_t n : thread) {
+            check.missing += n == 0;
+        }
+    }
+    return check;
+}
+
+/**
+ * Measurements of a run, sent from the child to the parent.
+ */
+struct Result {
+    double seconds;       // Until the producers are done.
+    double total_seconds; // Until the writer is done, too.
+    uint64_t p50, p99, p999, max;
+    double mean;
+};
+
+/**
+ * Runs one combination in the calling (child) process. Lines buffered by
+ * sync-mode reach the file when the logger is destroyed at exit.
+ */
+static Result run(const Config &config, const std::string &dir) {
+    Logger &logger = Logger::get_instance();
+    logger.init(dir, Logger::DEFAULT_ROLL_SIZE, config.buffer_size,
+                seconds(config.flush_interval));
+    if (config.pool > 0) {
+        logger.set_buffer_pool(config.pool);
+    }
+    logger.set_overflow_policy(Logger::BLOCK, Logger::DEFAULT_MAX_QUEUE_SIZE,
+                               seconds(600));
+    if (config.mode == "shared") {
+        logger.async_run(Logger::SHARED_BUFFER);
+    } else if (config.mode == "ring") {
+        logger.async_run(Logger::THREAD_RING);
+    }
+
+    std::vector<Histogram> hists(config.threads);
+    std::vector<std::thread> workers;
+    auto begin = steady_clock::now();
+    for (int i = 0; i < config.threads; ++i) {
+        workers.emplace_back(do_write, std::cref(config), i,
+                             std::ref(hists[i]));
+    }
+    for (auto &&thr : workers) {
+        thr.join();
+    }
+    auto produced = steady_clock::now();
+    logger.async_stop();
+    auto drained = steady_clock::now();
+
+    Histogram hist;
+    for (auto &&h : hists) {
+        hist.merge(h);
+    }
+
+    Result result;
+    result.seconds =
+        duration_cast<nanoseconds>(produced - begin).count() / 1e9;
+    result.total_seconds =
+        duration_cast<nanoseconds>(drained - begin).count() / 1e9;
+    result.p50 = hist.percentile(50);
+    result.p99 = hist.percentile(99);
+    result.p999 = hist.percentile(99.9);
+    result.max = hist.max();
+    result.mean = hist.mean();
+    return result;
+}
+
+/**
+ * Runs one combination in a child process and checks its files.
+ * @param json: receives the JSON object of the results.
+ * @return: false if the child failed.
+ */
+static bool run_child(const Config &config, const std::string &dir,
+                      std::string &json) {
+    mkdir(dir.c_str(), 0755);
+    for (auto &&file : list_files(dir)) {
+        unlink(file.c_str());
+    }
+
+    int fds[2];
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        Result result = run(config, dir);
+        if (write(fds[1], &result, sizeof(result)) != sizeof(result)) {
+            _exit(1);
+        }
+        exit(0); // Destroys the logger, flushing sync-mode.
+    }
+
+    close(fds[1]);
+    Result result;
+    ssize_t n = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (n != sizeof(result) || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+        return false;
+    }
+
+    Check check = check_files(dir, config);
+    for (auto &&file : list_files(dir)) {
+        unlink(file.c_str());
+    }
+    rmdir(dir.c_str());
+
+    // Throughput counts until the last line is written.
+    uint64_t lines = (uint64_t)config.threads * config.lines;
+    double total = result.total_seconds;
+    char buf[1024];
+    snprintf(buf, sizeof(buf),
+             "{\"mode\": \"%s\", \"threads\": %d, \"line_length\": %zu, "
+             "\"buffer_size\": %zu, \"pool_buffers\": %zu, "
+             "\"flush_interval\": %ld, \"lines\": %llu, "
+             "\"seconds\": %.6f, \"drain_seconds\": %.6f, "
+             "\"lines_per_sec\": %.0f, \"bytes_per_sec\": %.0f, "
+             "\"bytes_on_disk\": %llu, "
+             "\"latency_ns\": {\"p50\": %llu, \"p99\": %llu, "
+             "\"p99.9\": %llu, \"max\": %llu, \"mean\": %.1f}, "
+             "\"verified\": %s, \"lines_found\": %llu, \"missing\": %llu, "
+             "\"duplicates\": %llu}",
+             config.mode.c_str(), config.threads, config.line_length,
+             config.buffer_size, config.pool, config.flush_interval,
+             (unsigned long long)lines, result.seconds,
+             total - result.seconds, lines / total, check.bytes / total,
+             (unsigned long long)check.bytes, (unsigned long long)result.p50,
+             (unsigned long long)result.p99, (unsigned long long)result.p999,
+             (unsigned long long)result.max, result.mean,
+             check.missing == 0 && check.duplicates == 0 ? "true" : "false",
+             (unsigned long long)check.lines,
+             (unsigned long long)check.missing,
+             (unsigned long long)check.duplicates);
+    json = buf;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+
+    std::vector<long> threads;
+    for (unsigned n = 1; n < cores; n *= 2) {
+        threads.push_back(n);
+    }
+    threads.push_back(cores);
+    std::vector<long> lengths = {32, 128, 512};
+    std::vector<std::string> modes = {"sync", "shared", "ring"};
+    std::vector<long> buffer_sizes = {1 << 20, 1 << 23};
+    std::vector<long> intervals = {3};
+    int lines = 100000;
+    size_t pool = 0;
+    std::string dir = "./nilog-bench/";
+    std::string output;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:l:m:b:f:n:p:d:o:h")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = parse_list(optarg);
+            break;
+        case 'l':
+            lengths = parse_list(optarg);
+            break;
+        case 'm':
+            modes = parse_names(optarg);
+            break;
+        case 'b':
+            buffer_sizes = parse_list(optarg);
+            break;
+        case 'f':
+            intervals = parse_list(optarg);
+            break;
+        case 'n':
+            lines = atoi(optarg);
+            break;
+        case 'p':
+            pool = atol(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            if (dir.back() != '/') {
+                dir += '/';
+            }
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            std::cerr << usage;
+            return 1;
+        }
+    }
+
+    for (auto &&mode : modes) {
+        if (mode != "sync" && mode != "shared" && mode != "ring") {
+            std::cerr << "unknown mode " << mode << "\n" << usage;
+            return 1;
+        }
+    }
+
+    std::string json = "{\"cores\": " + std::to_string(cores) +
+                       ", \"results\": [\n";
+    bool ok = true;
+    bool first = true;
+    for (auto &&mode : modes) {
+        for (long t : threads) {
+            for (long length : lengths) {
+                for (long buffer_size : buffer_sizes) {
+                    for (long interval : intervals) {
+                        Config config{mode,     (int)t,
+                                      (size_t)length, (size_t)buffer_size,
+                                      interval, lines,    pool};
+                        std::string result;
+                        if (!run_child(config, dir, result)) {
+                            std::cerr << "run failed: " << mode << ", " << t
+                                      << " threads\n";
+                            return 1;
+                        }
+                        ok = ok && result.find("\"verified\": true") !=
+                                       std::string::npos;
+                        std::cerr << result << "\n";
+
+                        json += first ? "  " : ",\n  ";
+                        json += result;
+                        first = false;
+                    }
+                }
+            }
+        }
+    }
+    json += "\n]}\n";
+
+    if (output.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out(output);
+        out << json;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+#include "LogStream.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+/**
+ * Checks that the writer keeps up with inline compression at the rates of
+ * src/test/main.cc: 5 threads writing 1000000 lines each in async mode.
+ * Overflowing lines are dropped instead of blocking the producers, so a
+ * writer that falls behind shows up as dropped lines.
+ *
+ * usage: nilog-bench-seekable [plain|lz4] [ring]
+ * Run it in an empty directory, it sums the sizes of the files there.
+ */
+
+void do_write(int n) {
+    nijika::log::LogStream ls(nijika::log::Logger::DEBUG);
+    for (int i = 0; i < n; ++i) {
+        ls << newl << "A long line......."
+           << "..................";
+    }
+}
+
+static uint64_t dir_size(const char *path) {
+    uint64_t size = 0;
+    DIR *dir = opendir(path);
+    if (!dir) {
+        return 0;
+    }
+    while (dirent *ent = readdir(dir)) {
+        struct stat st;
+        std::string name = std::string(path) + ent->d_name;
+        if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            size += st.st_size;
+        }
+    }
+    closedir(dir);
+    return size;
+}
+
+int main(int argc, char **argv) {
+    using namespace nijika::log;
+    using namespace std::chrono;
+
+    const int n = 1000000;
+    const int threads = 5;
+    bool lz4 = argc > 1 && std::string(argv[1]) == "lz4";
+    bool ring = argc > 2 && std::string(argv[2]) == "ring";
+
+    FileOptions options;
+    options.inline_compress = lz4;
+
+    Logger &logger = Logger::get_instance();
+    logger.init(Logger::DEFAULT_PATH, Logger::DEFAULT_ROLL_SIZE,
+                Logger::DEFUALT_BUFFER_SIZE, Logger::DEFAULT_FLUSH_INTERVAL,
+                options);
+    logger.set_overflow_policy(Logger::DROP_NEWEST,
+                               Logger::DEFAULT_MAX_QUEUE_SIZE,
+                               std::chrono::milliseconds(0));
+    logger.async_run(ring ? Logger::THREAD_RING : Logger::SHARED_BUFFER);
+
+    auto begin = steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(do_write, n);
+    }
+    for (auto &&thr : workers) {
+        thr.join();
+    }
+    auto produced = steady_clock::now();
+    logger.async_stop();
+    auto drained = steady_clock::now();
+
+    auto produce_ms = duration_cast<milliseconds>(produced - begin).count();
+    auto drain_ms = duration_cast<milliseconds>(drained - produced).count();
+    Logger::OverflowStats stats = logger.overflow_stats();
+    uint64_t lines = (uint64_t)n * threads;
+
+    std::cout << (lz4 ? "inline lz4" : "plain") << ", "
+              << (ring ? "ring" : "shared buffer") << " mode\n"
+              << "  producers: " << produce_ms << "ms, "
+              << lines * 1000 / std::max<int64_t>(produce_ms, 1)
+              << " lines/s\n"
+              << "  drain after producers: " << drain_ms << "ms\n"
+              << "  dropped lines: " << stats.dropped_lines << "\n"
+              << "  bytes on disk: " << dir_size(Logger::DEFAULT_PATH)
+              << "\n";
+
+    return stats.dropped_lines == 0 ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+#include "LogStream.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Measures how THREAD_RING throughput scales with the number of writer
+ * shards. Every shard count runs in a child process, since the logger can
+ * only be initialized once, and writes into its own directory, which is
+ * emptied afterwards. The load is the line shape of src/test/main.cc with
+ * the BLOCK policy, so producers run at the pace of the writers.
+ *
+ * usage: nilog-bench-shards [max shards] [threads] [lines per thread]
+ */
+
+void do_write(int n) {
+    nijika::log::LogStream ls(nijika::log::Logger::DEBUG);
+    for (int i = 0; i < n; ++i) {
+        ls << newl << "A long line......."
+           << "..................";
+    }
+}
+
+/**
+ * Sums the sizes of the files in a directory, removing them if asked.
+ */
+static uint64_t dir_size(const std::string &path, bool remove) {
+    uint64_t size = 0;
+    DIR *dir = opendir(path.c_str());
+    if (!dir) {
+        return 0;
+    }
+    while (dirent *ent = readdir(dir)) {
+        struct stat st;
+        std::string name = path + ent->d_name;
+        if (stat(name.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+            size += st.st_size;
+            if (remove) {
+                unlink(name.c_str());
+            }
+        }
+    }
+    closedir(dir);
+    return size;
+}
+
+/**
+ * Runs the load with a number of shards, in a child process.
+ */
+static int run(unsigned shards, int threads, int n) {
+    using namespace nijika::log;
+    using namespace std::chrono;
+
+    std::string path = "./nilog-bench-shards-" + std::to_string(shards) + "/";
+    mkdir(path.c_str(), 0755);
+    dir_size(path, true);
+
+    Logger &logger = Logger::get_instance();
+    logger.init(path);
+    logger.set_overflow_policy(Logger::BLOCK, Logger::DEFAULT_MAX_QUEUE_SIZE,
+                               std::chrono::seconds(60));
+    logger.async_run(Logger::THREAD_RING, Logger::DEFAULT_RING_SIZE, shards);
+
+    auto begin = steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i) {
+        workers.emplace_back(do_write, n);
+    }
+    for (auto &&thr : workers) {
+        thr.join();
+    }
+    logger.async_stop();
+    auto end = steady_clock::now();
+
+    double secs = duration_cast<microseconds>(end - begin).count() / 1e6;
+    uint64_t bytes = dir_size(path, true);
+    rmdir(path.c_str());
+
+    printf("%6u %10.3f %14.0f %10.1f %10llu\n", shards, secs,
+           (double)threads * n / secs, bytes / secs / (1 << 20),
+           (unsigned long long)logger.overflow_stats().dropped_lines);
+    fflush(stdout); // The child leaves with _exit.
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    unsigned max_shards = argc > 1 ? atoi(argv[1]) : 8;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    int n = argc > 3 ? atoi(argv[3]) : 1000000;
+
+    printf("%d threads, %d lines each\n", threads, n);
+    printf("%6s %10s %14s %10s %10s\n", "shards", "seconds", "lines/s", "MB/s",
+           "dropped");
+    fflush(stdout);
+
+    for (unsigned shards = 1; shards <= max_shards; shards *= 2) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            _exit(run(shards, threads, n));
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "run with %u shards failed\n", shards);
+            return 1;
+        }
+    }
+
+    return 0;
+}
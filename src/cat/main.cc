@@ -0,0 +1,112 @@
+#include "util/SeekableLz4.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace nijika::util;
+
+/**
+ * Prints the frame index of a seekable file.
+ */
+static void print_index(const std::string &file,
+                        const std::vector<SeekableLz4::Frame> &frames,
+                        size_t size, uint64_t raw_size) {
+    std::cout << file << ": " << frames.size() << " frames, " << size
+              << " -> " << raw_size << " bytes";
+    if (size > 0) {
+        std::cout << ", ratio " << (double)raw_size / size;
+    }
+    std::cout << "\n";
+
+    for (auto &&frame : frames) {
+        std::cout << "  offset " << frame.offset << "  raw offset "
+                  << frame.raw_offset << "\n";
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t offset = 0;
+    uint64_t count = UINT64_MAX;
+    bool index = false;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-s" && i + 1 < argc) {
+            offset = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "-n" && i + 1 < argc) {
+            count = strtoull(argv[++i], nullptr, 0);
+        } else if (arg == "-i") {
+            index = true;
+        } else if (arg == "-h" || arg == "--help") {
+            files.clear();
+            break;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "usage: nilog-cat [-i] [-s offset] [-n bytes] file...\n"
+                  << "  Prints log files written with inline_compress.\n"
+                  << "  -i  print the frame index instead.\n"
+                  << "  -s  start at this uncompressed offset.\n"
+                  << "  -n  print at most this many bytes.\n"
+                  << "  Only the frames overlapping the range are read.\n";
+        return 1;
+    }
+
+    int ret = 0;
+    for (auto &&file : files) {
+        // Mapped, so only the index and the frames in range are read.
+        int fd = open(file.c_str(), O_RDONLY);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            if (fd != -1) {
+                close(fd);
+            }
+            std::cerr << file << ": cannot open\n";
+            ret = 1;
+            continue;
+        }
+        size_t size = st.st_size;
+        void *addr = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE,
+                                     fd, 0)
+                              : nullptr;
+        close(fd);
+        if (addr == MAP_FAILED) {
+            std::cerr << file << ": cannot map\n";
+            ret = 1;
+            continue;
+        }
+        const char *data = (const char *)addr;
+
+        std::vector<SeekableLz4::Frame> frames;
+        uint64_t raw_size;
+        std::string out;
+        if (!SeekableLz4::load_index(data, size, frames, &raw_size)) {
+            std::cerr << file << ": not a seekable lz4 file\n";
+            ret = 1;
+        } else if (index) {
+            print_index(file, frames, size, raw_size);
+        } else if (!SeekableLz4::read(data, size, frames, offset, count,
+                                      out)) {
+            std::cerr << file << ": corrupted frame\n";
+            ret = 1;
+        }
+        std::cout.write(out.data(), out.size());
+
+        if (addr) {
+            munmap(addr, size);
+        }
+    }
+
+    return ret;
+}
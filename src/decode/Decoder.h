@@ -0,0 +1,281 @@
+#pragma once
+
+#include "log/BinaryLog.h"
+#include "util/NumberFormat.h"
+#include "util/TimeUtil.h"
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <string.h>
+
+namespace nijika {
+
+namespace log {
+
+/**
+ * A site definition read back from a binary log file.
+ */
+struct Site {
+    uint32_t level;
+    uint32_t line;
+    std::vector<uint8_t> types;
+    std::string file;
+    std::string func;
+    std::string fmt;
+};
+
+/**
+ * Decodes one binary log file into text log lines.
+ */
+class Decoder {
+  public:
+    Decoder(std::ostream &out, util::TimestampFormatter::zone zone)
+        : out_(out), zone_(zone) {}
+
+    /**
+     * Decodes the records up to the first zero-size or truncated one, e.g.
+     * the preallocated or padded tail a crash leaves, with a warning.
+     * @return: false if the file is not a valid binary log file.
+     */
+    bool decode(const std::string &data) {
+        if (data.empty()) {
+            // Created but never written, e.g. by a crashed process.
+            return true;
+        }
+        if (data.size() < sizeof(BinaryLog::MAGIC) ||
+            memcmp(data.data(), BinaryLog::MAGIC, sizeof(BinaryLog::MAGIC))) {
+            std::cerr << "not a binary log file\n";
+            return false;
+        }
+
+        // Definitions may follow their first use when producers race, so
+        // collect all of them first.
+        size_t end = walk(data, data.size(), true);
+        if (end < data.size()) {
+            std::cerr << "truncated or corrupted record at offset " << end
+                      << ", decoding stops there\n";
+        }
+        walk(data, end, false);
+        return true;
+    }
+
+  private:
+    std::ostream &out_;
+    util::TimestampFormatter::zone zone_;
+    util::TimestampFormatter formatter_;
+    std::unordered_map<uint32_t, Site> sites_;
+    std::string line_;
+
+    /**
+     * @return: offset of the first record not whole, or end.
+     */
+    size_t walk(const std::string &data, size_t end, bool define) {
+        size_t pos = sizeof(BinaryLog::MAGIC);
+        BinaryLog::RecordHeader header;
+
+        while (pos < end) {
+            if (end - pos < sizeof(header)) {
+                return pos;
+            }
+            memcpy(&header, data.data() + pos, sizeof(header));
+            if (header.size < sizeof(header) || header.size > end - pos) {
+                return pos;
+            }
+
+            const char *payload = data.data() + pos + sizeof(header);
+            size_t len = header.size - sizeof(header);
+            pos += header.size;
+
+            if (header.site == BinaryLog::SITE_RECORD) {
+                if (define) {
+                    read_site(payload, len);
+                }
+            } else if (define) {
+                continue;
+            } else if (header.site == BinaryLog::TEXT_RECORD) {
+                out_.write(payload, len);
+            } else {
+                render(header, payload, len);
+            }
+        }
+
+        return pos;
+    }
+
+    void read_site(const char *p, size_t len) {
+        uint32_t fields[4];
+        if (len < sizeof(fields)) {
+            return;
+        }
+        memcpy(fields, p, sizeof(fields));
+
+        const char *end = p + len;
+        p += sizeof(fields);
+        if (fields[3] > (size_t)(end - p)) {
+            return;
+        }
+        Site site;
+        site.level = fields[1];
+        site.line = fields[2];
+        site.types.assign(p, p + fields[3]);
+        p += fields[3];
+
+        // The strings are null-terminated, unless the record is corrupted.
+        std::string *strs[3] = {&site.file, &site.func, &site.fmt};
+        for (auto &&str : strs) {
+            size_t n = strnlen(p, end - p);
+            str->assign(p, n);
+            p += std::min(n + 1, (size_t)(end - p));
+        }
+
+        sites_[fields[0]] = std::move(site);
+    }
+
+    void render(const BinaryLog::RecordHeader &header, const char *p,
+                size_t len) {
+        auto it = sites_.find(header.site);
+        if (it == sites_.end()) {
+            std::cerr << "unknown site " << header.site << "\n";
+            return;
+        }
+        const Site &site = it->second;
+        const char *end = p + len;
+
+        line_.clear();
+        line_ += "[";
+        line_ += site.level < 6 ? Logger::level_str[site.level] : "?";
+        line_ += "][TID: " + std::to_string(header.tid) + "]";
+        line_ += "[FILE: " + site.file + "]";
+        line_ += "[FUNC: " + site.func + "]";
+        line_ += "[LINE: " + std::to_string(site.line) + "][";
+
+        char time[util::TimestampFormatter::LENGTH];
+        using namespace std::chrono;
+        formatter_.format(time,
+                          system_clock::time_point(duration_cast<microseconds>(
+                              nanoseconds(header.time))),
+                          zone_);
+        line_.append(time, sizeof(time));
+        line_ += "] ";
+
+        size_t fmt_pos = 0;
+        for (uint8_t type : site.types) {
+            size_t next = site.fmt.find("{}", fmt_pos);
+            if (next == std::string::npos) {
+                // More arguments than placeholders.
+                line_.append(site.fmt, fmt_pos);
+                fmt_pos = site.fmt.size();
+                line_ += ' ';
+            } else {
+                line_.append(site.fmt, fmt_pos, next - fmt_pos);
+                fmt_pos = next + 2;
+            }
+
+            if (!render_arg(type, p, end)) {
+                line_ += "<truncated>";
+                break;
+            }
+        }
+        if (fmt_pos < site.fmt.size()) {
+            line_.append(site.fmt, fmt_pos);
+        }
+        line_ += '\n';
+
+        out_.write(line_.data(), line_.size());
+    }
+
+    template <typename T> bool read(const char *&p, const char *end, T &v) {
+        if (end - p < (ptrdiff_t)sizeof(T)) {
+            return false;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return true;
+    }
+
+    // Mirrors the formatting of LogStream.
+    bool render_arg(uint8_t type, const char *&p, const char *end) {
+        char tmp[64];
+        char *res = tmp;
+
+        switch (type) {
+        case BinaryLog::INT64: {
+            int64_t v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            res = util::NumberFormat::integer(tmp, v);
+            break;
+        }
+        case BinaryLog::UINT64: {
+            uint64_t v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            res = util::NumberFormat::integer(tmp, v);
+            break;
+        }
+        case BinaryLog::FLOAT: {
+            float v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            res = util::NumberFormat::floating(tmp, v);
+            break;
+        }
+        case BinaryLog::DOUBLE: {
+            double v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            res = util::NumberFormat::floating(tmp, v);
+            break;
+        }
+        case BinaryLog::CHAR: {
+            char v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            *res++ = v;
+            break;
+        }
+        case BinaryLog::BOOL: {
+            char v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            *res++ = v ? '1' : '0';
+            break;
+        }
+        case BinaryLog::STRING: {
+            uint32_t n;
+            if (!read(p, end, n) || end - p < (ptrdiff_t)n) {
+                return false;
+            }
+            line_.append(p, n);
+            p += n;
+            break;
+        }
+        case BinaryLog::POINTER: {
+            uint64_t v;
+            if (!read(p, end, v)) {
+                return false;
+            }
+            res = util::NumberFormat::pointer(tmp, v);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        line_.append(tmp, res - tmp);
+        return true;
+    }
+};
+
+} // namespace log
+
+} // namespace nijika
@@ -0,0 +1,73 @@
+#include "Decoder.h"
+#include "util/Lz4.h"
+#include "util/TimeUtil.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+using namespace nijika::log;
+using namespace nijika::util;
+
+int main(int argc, char **argv) {
+    TimestampFormatter::zone zone = TimestampFormatter::LOCAL;
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-u") {
+            zone = TimestampFormatter::UTC;
+        } else if (arg == "-h" || arg == "--help") {
+            files.clear();
+            break;
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    if (files.empty()) {
+        std::cerr << "usage: nilog-decode [-u] file...\n"
+                  << "  Decodes binary log files, or their .lz4, to stdout.\n"
+                  << "  -u  print timestamps in UTC.\n";
+        return 1;
+    }
+
+    int ret = 0;
+    for (auto &&file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << file << ": cannot open\n";
+            ret = 1;
+            continue;
+        }
+
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+        // A compressed file, rotated or written with inline_compress.
+        uint32_t magic = 0;
+        if (data.size() >= sizeof(magic)) {
+            memcpy(&magic, data.data(), sizeof(magic));
+        }
+        if (magic == Lz4::FRAME_MAGIC) {
+            std::string raw;
+            if (!Lz4::decompress_stream(data.data(), data.size(), raw)) {
+                std::cerr << file << ": corrupted lz4 frame\n";
+                ret = 1;
+                continue;
+            }
+            data.swap(raw);
+        }
+        Decoder decoder(std::cout, zone);
+        if (!decoder.decode(data)) {
+            std::cerr << file << ": decoding failed\n";
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
\ No newline at end of file
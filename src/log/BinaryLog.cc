@@ -0,0 +1,194 @@
+#include "log/BinaryLog.h"
+
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace log {
+
+namespace {
+
+struct SiteEntry {
+    const BinarySite *site;
+    const uint8_t *types;
+    size_t nargs;
+};
+
+std::mutex sites_mut;         // Guards the two below.
+std::vector<SiteEntry> sites; // Registered sites, id is index + 1.
+int sites_fd = -1;            // See BinaryLog::keep_sites.
+
+// Size of sites, published before the ids. (see BinaryLog::file_header)
+std::atomic<size_t> site_count(0);
+
+/**
+ * Writes to the file of keep_sites. A crash of the machine may lose it,
+ * as it may lose the persistent ring, so no error is worth reporting.
+ */
+void write_sites(const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t res = write(sites_fd, data.data() + written,
+                            data.size() - written);
+        if (res == -1 && errno != EINTR) {
+            return;
+        }
+        written += res > 0 ? res : 0;
+    }
+}
+
+} // namespace
+
+uint32_t BinaryLog::register_site(BinarySite &site, const uint8_t *types,
+                                  size_t nargs) {
+    std::lock_guard<std::mutex> lock(sites_mut);
+    uint32_t id = site.id.load(std::memory_order_relaxed);
+    if (id != 0) {
+        // Registered by another thread.
+        return id;
+    }
+
+    sites.push_back({&site, types, nargs});
+    id = sites.size();
+    if (sites_fd != -1) {
+        // Before any record of the site can reach the persistent ring.
+        std::string def;
+        append_site(def, id, site, types, nargs);
+        write_sites(def);
+    }
+
+    // The writers append the definition before any record using the id,
+    // as they see the count first.
+    site_count.store(id, std::memory_order_release);
+    site.id.store(id, std::memory_order_release);
+
+    return id;
+}
+
+const SourceSite &BinaryLog::source_site(BinarySite &site) {
+    const SourceSite *source = site.source.load(std::memory_order_acquire);
+    if (source) {
+        return *source;
+    }
+
+    std::lock_guard<std::mutex> lock(sites_mut);
+    source = site.source.load(std::memory_order_relaxed);
+    if (!source) {
+        // Lives as long as the static site.
+        source = new SourceSite(site.file, site.func, site.line);
+        site.source.store(source, std::memory_order_release);
+    }
+
+    return *source;
+}
+
+void BinaryLog::append_site(std::string &out, uint32_t id,
+                            const BinarySite &site, const uint8_t *types,
+                            size_t nargs) {
+    // Payload: id, level, line, nargs (uint32_t each), the argument types,
+    // then file, func and fmt as null-terminated strings.
+    size_t file_len = strlen(site.file) + 1;
+    size_t func_len = strlen(site.func) + 1;
+    size_t fmt_len = strlen(site.fmt) + 1;
+    size_t size = sizeof(RecordHeader) + sizeof(uint32_t) * 4 + nargs +
+                  file_len + func_len + fmt_len;
+
+    RecordHeader header{(uint32_t)size, SITE_RECORD, 0, 0, 0};
+    uint32_t fields[4] = {id, (uint32_t)site.level, (uint32_t)site.line,
+                          (uint32_t)nargs};
+
+    out.append((const char *)&header, sizeof(header));
+    out.append((const char *)fields, sizeof(fields));
+    out.append((const char *)types, nargs);
+    out.append(site.file, file_len);
+    out.append(site.func, func_len);
+    out.append(site.fmt, fmt_len);
+}
+
+size_t BinaryLog::text_record(char *rec, const char *line, size_t len) {
+    RecordHeader header{};
+    len = std::min(len, MAX_RECORD_SIZE - sizeof(header));
+
+    header.size = sizeof(header) + len;
+    header.site = TEXT_RECORD;
+    header.time = now();
+    header.tid = get_tid();
+    memcpy(rec, &header, sizeof(header));
+    memcpy(rec + sizeof(header), line, len);
+
+    if (len > 0 && line[len - 1] != '\n') {
+        // Truncated, keep the line terminated.
+        rec[header.size - 1] = '\n';
+    }
+
+    return header.size;
+}
+
+size_t BinaryLog::file_header(std::string &out, size_t from) {
+    if (from > 0 &&
+        site_count.load(std::memory_order_acquire) + 1 == from) {
+        // Nothing new, the common case.
+        return from;
+    }
+
+    if (from == 0) {
+        out.append(MAGIC, sizeof(MAGIC));
+        from = 1;
+    }
+
+    std::lock_guard<std::mutex> lock(sites_mut);
+    for (size_t i = from - 1; i < sites.size(); ++i) {
+        append_site(out, i + 1, *sites[i].site, sites[i].types,
+                    sites[i].nargs);
+    }
+
+    return sites.size() + 1;
+}
+
+void BinaryLog::keep_sites(const std::string &path) {
+    std::lock_guard<std::mutex> lock(sites_mut);
+    if (sites_fd != -1) {
+        close(sites_fd);
+        sites_fd = -1;
+    }
+    if (path.empty()) {
+        return;
+    }
+
+    sites_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    0644);
+    if (sites_fd == -1) {
+        return;
+    }
+
+    std::string header(MAGIC, sizeof(MAGIC));
+    for (size_t i = 0; i < sites.size(); ++i) {
+        append_site(header, i + 1, *sites[i].site, sites[i].types,
+                    sites[i].nargs);
+    }
+    write_sites(header);
+}
+
+bool BinaryLog::binary() { return Logger::get_instance().binary_; }
+
+void BinaryLog::submit(const char *rec, size_t len, Logger::level level) {
+    Logger &logger = Logger::get_instance();
+    logger.submit(rec, len, level, level >= logger.durable_level());
+}
+
+int64_t BinaryLog::now() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(
+               system_clock::now().time_since_epoch())
+        .count();
+}
+
+} // namespace log
+
+} // namespace nijika
\ No newline at end of file
@@ -0,0 +1,320 @@
+/**
+ * This is a public header.
+ */
+
+#pragma once
+
+#include "log/LogStream.h"
+#include "util/ProcessInfo.h"
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace nijika {
+
+namespace log {
+
+/**
+ * Static metadata of a binary log call site. Constant-initialized, so
+ * declaring one as a function-local static costs no guard.
+ */
+struct BinarySite {
+    constexpr BinarySite(Logger::level level, const char *file,
+                         const char *func, int line, const char *fmt) noexcept
+        : level(level), file(file), func(func), line(line), fmt(fmt), id(0),
+          source(nullptr) {}
+
+    Logger::level level;
+    const char *file;
+    const char *func;
+    int line;
+    const char *fmt;          // "{}" marks an argument.
+    std::atomic<uint32_t> id; // 0 until registered.
+
+    // Source site for text mode, built on first use.
+    std::atomic<const SourceSite *> source;
+};
+
+/**
+ * Binary deferred-formatting front-end. The caller thread only copies the
+ * raw arguments and a raw timestamp, nilog-decode renders the text later.
+ *
+ * Binary file layout (native byte order):
+ *   MAGIC, then a sequence of records, each starting with a RecordHeader.
+ *   SITE_RECORD: payload is a site definition. (see file_header)
+ *   TEXT_RECORD: payload is an already formatted text line.
+ *   Otherwise: payload is the encoded arguments of the site.
+ */
+class BinaryLog {
+  public:
+    static constexpr char MAGIC[8] = {'N', 'I', 'L', 'O', 'G', 'B', 'I', 'N'};
+    static constexpr uint32_t TEXT_RECORD = 0xfffffffe;
+    static constexpr uint32_t SITE_RECORD = 0xffffffff;
+    static constexpr size_t MAX_RECORD_SIZE = 4096;
+
+    struct RecordHeader {
+        uint32_t size; // Size of the record, including this header.
+        uint32_t site; // Site id, TEXT_RECORD or SITE_RECORD.
+        int64_t time;  // Nanoseconds since epoch.
+        uint32_t tid;  // Thread id.
+        uint32_t reserved;
+    };
+
+    enum arg_type : uint8_t {
+        INT64 = 1, // 8 bytes.
+        UINT64,    // 8 bytes.
+        DOUBLE,    // 8 bytes.
+        CHAR,      // 1 byte.
+        BOOL,      // 1 byte.
+        STRING,    // uint32_t length, then the bytes.
+        POINTER,   // 8 bytes.
+        FLOAT      // 4 bytes, so it decodes as the shortest float.
+    };
+
+    /**
+     * Writes a binary record. In text mode the line is formatted on the
+     * calling thread instead, so the output is the same either way.
+     * @param site: static call site metadata.
+     * @param args: arguments for the "{}" in site.fmt.
+     */
+    template <typename... Args>
+    static void write(BinarySite &site, const Args &...args);
+
+    /**
+     * Wraps a text line as a text record, truncating it to MAX_RECORD_SIZE.
+     * @param rec: destination, at least MAX_RECORD_SIZE bytes.
+     * @param line: pointer to the text line.
+     * @param len: size of the text line.
+     * @return: size of the record.
+     */
+    static size_t text_record(char *rec, const char *line, size_t len);
+
+    /**
+     * Appends the header of binary log files: the magic, followed by the
+     * definitions of all registered sites. Called again before appending
+     * records, it appends the sites registered since, so every file, shard
+     * files included, defines the sites its records use.
+     * @param out: receives the header.
+     * @param from: header entries already written, the magic counts as one.
+     * @return: header entries written so far.
+     */
+    static size_t file_header(std::string &out, size_t from);
+
+    /**
+     * Keeps the definitions of all the sites in a file, so records a crash
+     * leaves in the persistent ring can still be decoded: writes the magic
+     * and the sites registered so far, then appends every new site before
+     * its id is used. (see FileOptions::persist_path)
+     * @param path: file path, empty to stop.
+     */
+    static void keep_sites(const std::string &path);
+
+  private:
+    /**
+     * Registers a site. Its definition reaches every log file before the
+     * first record using the id, see file_header.
+     * @return: the site id.
+     */
+    static uint32_t register_site(BinarySite &site, const uint8_t *types,
+                                  size_t nargs);
+
+    /**
+     * @return: the source site of a binary site, built on first use.
+     */
+    static const SourceSite &source_site(BinarySite &site);
+
+    /**
+     * Appends the definition record of a site.
+     */
+    static void append_site(std::string &out, uint32_t id,
+                            const BinarySite &site, const uint8_t *types,
+                            size_t nargs);
+
+    /**
+     * @return: true if the Logger writes binary log files.
+     */
+    static bool binary();
+
+    /**
+     * Hands a finished record to the Logger, waiting for the disk from the
+     * durable level on.
+     */
+    static void submit(const char *rec, size_t len, Logger::level level);
+
+    /**
+     * @return: nanoseconds since epoch.
+     */
+    static int64_t now();
+
+    template <typename T> static constexpr arg_type type_of() {
+        using U = std::decay_t<T>;
+        if constexpr (std::is_same_v<U, bool>) {
+            return BOOL;
+        } else if constexpr (std::is_same_v<U, char>) {
+            return CHAR;
+        } else if constexpr (std::is_enum_v<U>) {
+            return std::is_signed_v<std::underlying_type_t<U>> ? INT64
+                                                                : UINT64;
+        } else if constexpr (std::is_integral_v<U>) {
+            return std::is_signed_v<U> ? INT64 : UINT64;
+        } else if constexpr (std::is_same_v<U, float>) {
+            return FLOAT;
+        } else if constexpr (std::is_floating_point_v<U>) {
+            return DOUBLE;
+        } else if constexpr (std::is_convertible_v<const T &,
+                                                   std::string_view>) {
+            return STRING;
+        } else if constexpr (std::is_pointer_v<U>) {
+            return POINTER;
+        } else {
+            static_assert(!sizeof(T *), "Unsupported binary log argument.");
+        }
+    }
+
+    static constexpr size_t fixed_size(arg_type type) {
+        switch (type) {
+        case CHAR:
+        case BOOL:
+            return 1;
+        case STRING:
+        case FLOAT:
+            return sizeof(uint32_t);
+        default:
+            return 8;
+        }
+    }
+
+    template <typename T>
+    static void encode(char *&p, size_t &budget, const T &v) {
+        constexpr arg_type type = type_of<T>();
+        if constexpr (type == STRING) {
+            std::string_view s;
+            if constexpr (std::is_array_v<T>) {
+                // A literal or a buffer, never null.
+                s = std::string_view(v, strnlen(v, std::extent_v<T>));
+            } else if constexpr (std::is_pointer_v<T>) {
+                s = v ? v : "(null)";
+            } else {
+                s = v;
+            }
+            uint32_t len = std::min(s.size(), budget);
+            budget -= len;
+            memcpy(p, &len, sizeof(len));
+            memcpy(p + sizeof(len), s.data(), len);
+            p += sizeof(len) + len;
+        } else if constexpr (type == CHAR || type == BOOL) {
+            *p++ = (char)v;
+        } else if constexpr (type == INT64) {
+            int64_t x = (int64_t)v;
+            memcpy(p, &x, 8);
+            p += 8;
+        } else if constexpr (type == UINT64) {
+            uint64_t x = (uint64_t)v;
+            memcpy(p, &x, 8);
+            p += 8;
+        } else if constexpr (type == FLOAT) {
+            float x = v;
+            memcpy(p, &x, 4);
+            p += 4;
+        } else if constexpr (type == DOUBLE) {
+            double x = v;
+            memcpy(p, &x, 8);
+            p += 8;
+        } else {
+            uint64_t x = (uintptr_t)v;
+            memcpy(p, &x, 8);
+            p += 8;
+        }
+    }
+
+    template <typename T>
+    static void format_arg(LogStream &ls, const char *&fmt, const T &v) {
+        const char *p = strstr(fmt, "{}");
+        if (!p) {
+            // More arguments than placeholders.
+            ls << fmt << ' ';
+            fmt += strlen(fmt);
+        } else {
+            ls.append(fmt, p - fmt);
+            fmt = p + 2;
+        }
+
+        if constexpr (type_of<T>() == POINTER) {
+            ls << (const void *)v;
+        } else if constexpr (std::is_enum_v<T>) {
+            ls << (std::underlying_type_t<T>)v;
+        } else {
+            ls << v;
+        }
+    }
+};
+
+template <typename... Args>
+void BinaryLog::write(BinarySite &site, const Args &...args) {
+    if (!binary()) {
+        // Text mode, format on the calling thread.
+        LogStream ls(site.level);
+        ls << NewLine(source_site(site));
+        const char *fmt = site.fmt;
+        (format_arg(ls, fmt, args), ...);
+        ls << fmt;
+        return;
+    }
+
+    static constexpr uint8_t types[] = {type_of<Args>()..., 0};
+    static constexpr size_t fixed = (sizeof(RecordHeader) + ... +
+                                     fixed_size(type_of<Args>()));
+    static_assert(fixed <= MAX_RECORD_SIZE, "Too many arguments.");
+
+    uint32_t id = site.id.load(std::memory_order_acquire);
+    if (id == 0) {
+        id = register_site(site, types, sizeof...(Args));
+    }
+
+    char rec[MAX_RECORD_SIZE];
+    char *p = rec + sizeof(RecordHeader);
+    size_t budget = MAX_RECORD_SIZE - fixed; // Shared by string arguments.
+    (encode(p, budget, args), ...);
+
+    RecordHeader header{(uint32_t)(p - rec), id, now(), (uint32_t)get_tid(),
+                        0};
+    memcpy(rec, &header, sizeof(header));
+    submit(rec, p - rec, site.level);
+}
+
+/**
+ * Writes a binary log record, e.g. NIJIKA_BLOG_INFO("x = {}", x);
+ * The format string must be a literal, it is stored once per call site.
+ */
+#define NIJIKA_BLOG(lvl, fmt, ...)                                             \
+    do {                                                                       \
+        if ((lvl) >= NIJIKA_LOG_MIN_LEVEL &&                                   \
+            nijika::log::Logger::enabled(lvl)) {                               \
+            static nijika::log::BinarySite nijika_site_(lvl, __FILE__,         \
+                                                        __func__, __LINE__,    \
+                                                        fmt);                  \
+            nijika::log::BinaryLog::write(nijika_site_, ##__VA_ARGS__);        \
+        }                                                                      \
+    } while (0)
+
+#define NIJIKA_BLOG_DEBUG(...)                                                 \
+    NIJIKA_BLOG(nijika::log::Logger::DEBUG, __VA_ARGS__)
+#define NIJIKA_BLOG_INFO(...)                                                  \
+    NIJIKA_BLOG(nijika::log::Logger::INFO, __VA_ARGS__)
+#define NIJIKA_BLOG_TRACE(...)                                                 \
+    NIJIKA_BLOG(nijika::log::Logger::TRACE, __VA_ARGS__)
+#define NIJIKA_BLOG_WARN(...)                                                  \
+    NIJIKA_BLOG(nijika::log::Logger::WARN, __VA_ARGS__)
+#define NIJIKA_BLOG_ERROR(...)                                                 \
+    NIJIKA_BLOG(nijika::log::Logger::ERROR, __VA_ARGS__)
+#define NIJIKA_BLOG_FATAL(...)                                                 \
+    NIJIKA_BLOG(nijika::log::Logger::FATAL, __VA_ARGS__)
+
+} // namespace log
+
+} // namespace nijika
\ No newline at end of file
@@ -0,0 +1,201 @@
+#include "log/LogCompressor.h"
+#include "util/Lz4.h"
+#include "util/ProcessInfo.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace log {
+
+struct LogCompressor::Job {
+    std::string path;
+    const char *data = nullptr; // Read-only mapping of the file.
+    size_t size = 0;
+    std::vector<std::string> blocks; // Compressed frame blocks.
+    std::atomic<size_t> remaining;   // Blocks not compressed yet.
+
+    ~Job() {
+        if (data) {
+            munmap((void *)data, size);
+        }
+    }
+};
+
+static bool write_all(int fd, const std::string &data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t res = write(fd, data.data() + written, data.size() - written);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        written += res;
+    }
+    return true;
+}
+
+LogCompressor::LogCompressor(unsigned threads, int nice)
+    : nice_(nice), stop_(false), files_(0), failed_(0), bytes_in_(0),
+      bytes_out_(0), nanos_(0) {
+    threads = std::max(threads, 1u);
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back(&LogCompressor::worker_func, this);
+    }
+}
+
+LogCompressor::~LogCompressor() {
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+
+    for (auto &&worker : workers_) {
+        worker.join();
+    }
+}
+
+void LogCompressor::add(const std::string &path) {
+    auto job = std::make_shared<Job>();
+    job->path = path;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        failed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    job->size = st.st_size;
+    if (job->size > 0) {
+        void *addr = mmap(nullptr, job->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            failed_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        job->data = (const char *)addr;
+        madvise(addr, job->size, MADV_SEQUENTIAL);
+    }
+    close(fd); // The mapping stays valid.
+
+    size_t blocks = (job->size + Lz4::MAX_BLOCK_SIZE - 1) / Lz4::MAX_BLOCK_SIZE;
+    job->blocks.resize(blocks);
+    job->remaining.store(blocks, std::memory_order_relaxed);
+
+    if (blocks == 0) {
+        finish(*job);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        for (size_t i = 0; i < blocks; ++i) {
+            tasks_.push_back({job, i});
+        }
+    }
+    cv_.notify_all();
+}
+
+Logger::CompressionStats LogCompressor::stats() const {
+    Logger::CompressionStats stats;
+    stats.files = files_.load(std::memory_order_relaxed);
+    stats.failed = failed_.load(std::memory_order_relaxed);
+    stats.bytes_in = bytes_in_.load(std::memory_order_relaxed);
+    stats.bytes_out = bytes_out_.load(std::memory_order_relaxed);
+    stats.nanos = nanos_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void LogCompressor::worker_func() {
+    // Applies to this thread only on Linux. Failing to raise the priority
+    // without privileges is fine.
+    setpriority(PRIO_PROCESS, get_tid(), nice_);
+
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mut_);
+            cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) {
+                return; // Stopped, and all queued files are done.
+            }
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+
+        run(task);
+    }
+}
+
+void LogCompressor::run(Task &task) {
+    using namespace std::chrono;
+    auto start = steady_clock::now();
+
+    Job &job = *task.job;
+    size_t offset = task.block * Lz4::MAX_BLOCK_SIZE;
+    Lz4::frame_block(job.blocks[task.block], job.data + offset,
+                     std::min(Lz4::MAX_BLOCK_SIZE, job.size - offset));
+
+    if (job.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        finish(job);
+    }
+
+    nanos_.fetch_add(
+        duration_cast<nanoseconds>(steady_clock::now() - start).count(),
+        std::memory_order_relaxed);
+}
+
+void LogCompressor::finish(Job &job) {
+    std::string tmp = job.path + ".lz4.tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    uint64_t bytes_out = 0;
+    bool ok = fd != -1;
+    if (ok) {
+        std::string header = Lz4::frame_header(job.size);
+        std::string end = Lz4::frame_end();
+        ok = write_all(fd, header);
+        for (auto &&block : job.blocks) {
+            ok = ok && write_all(fd, block);
+            bytes_out += block.size();
+        }
+        ok = ok && write_all(fd, end);
+        bytes_out += header.size() + end.size();
+
+        // Persist the data before the original goes away.
+        ok = fdatasync(fd) == 0 && ok;
+        close(fd);
+    }
+
+    // rename is atomic, readers see either file complete.
+    if (!ok || rename(tmp.c_str(), (job.path + ".lz4").c_str()) == -1) {
+        unlink(tmp.c_str());
+        failed_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    unlink(job.path.c_str());
+
+    files_.fetch_add(1, std::memory_order_relaxed);
+    bytes_in_.fetch_add(job.size, std::memory_order_relaxed);
+    bytes_out_.fetch_add(bytes_out, std::memory_order_relaxed);
+}
+
+} // namespace log
+
+} // namespace nijika
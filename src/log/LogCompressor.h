@@ -0,0 +1,94 @@
+#pragma once
+
+#include "log/Logger.h"
+#include "util/Noncopyable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nijika {
+
+namespace log {
+
+using namespace util;
+
+/**
+ * Background compressor of rotated log files. Each file is split into LZ4
+ * blocks compressed in parallel by the worker pool, then written as
+ * name.lz4, which atomically replaces the original.
+ * @thread-safety: safe.
+ */
+class LogCompressor : Noncopyable {
+  public:
+    /**
+     * Starts the worker pool.
+     * @param threads: number of worker threads.
+     * @param nice: nice value of the worker threads.
+     */
+    LogCompressor(unsigned threads, int nice);
+
+    /**
+     * Finishes the queued files and stops the workers.
+     */
+    ~LogCompressor();
+
+    /**
+     * Queues a closed file for compression.
+     * @param path: path of the file.
+     */
+    void add(const std::string &path);
+
+    /**
+     * @return: a snapshot of the counters.
+     */
+    Logger::CompressionStats stats() const;
+
+  private:
+    struct Job;
+
+    // One block of a file.
+    struct Task {
+        std::shared_ptr<Job> job;
+        size_t block;
+    };
+
+    std::vector<std::thread> workers_; // Worker pool.
+    int nice_;                         // Nice value of the workers.
+
+    std::mutex mut_;             // Guards the fields below.
+    std::condition_variable cv_; // For workers waiting for tasks.
+    std::deque<Task> tasks_;     // Pending blocks, in file order.
+    bool stop_;                  // Stops the workers once idle.
+
+    std::atomic<uint64_t> files_;     // See CompressionStats.
+    std::atomic<uint64_t> failed_;    // See CompressionStats.
+    std::atomic<uint64_t> bytes_in_;  // See CompressionStats.
+    std::atomic<uint64_t> bytes_out_; // See CompressionStats.
+    std::atomic<uint64_t> nanos_;     // See CompressionStats.
+
+    /**
+     * Worker thread function.
+     */
+    void worker_func();
+
+    /**
+     * Compresses one block, finishing the file after its last block.
+     */
+    void run(Task &task);
+
+    /**
+     * Writes the compressed file and removes the original. The original is
+     * kept on failure.
+     */
+    void finish(Job &job);
+};
+
+} // namespace log
+
+} // namespace nijika
@@ -1,39 +1,306 @@
 #include "log/LogFile.h"
+#include "util/Lz4.h"
 #include "util/ProcessInfo.h"
 #include "util/TimeUtil.h"
 
 #include <stdexcept>
 #include <system_error>
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 namespace nijika {
 
 namespace log {
 
-LogFile::LogFile(const std::string &path, off_t roll_size, size_t buffer_size)
-    : file_size_(0), roll_size_(roll_size), buffer_(buffer_size), path_(path) {
-    fd_ = open(get_file_name().c_str(), O_WRONLY | O_CREAT, 0644);
-    if (fd_ == -1) {
+LogFile::LogFile(const std::string &path, off_t roll_size, size_t buffer_size,
+                 const FileOptions &options, header_func header, int shard)
+    : file_size_(0), roll_size_(roll_size),
+      buffer_(options.mode == FileOptions::MMAP ? FixedBuffer()
+              : options.mode == FileOptions::DIRECT
+                  ? FixedBuffer((buffer_size + DIRECT_ALIGN - 1) /
+                                    DIRECT_ALIGN * DIRECT_ALIGN,
+                                DIRECT_ALIGN)
+                  : FixedBuffer(buffer_size)),
+      path_(path), options_(options), header_(header), header_count_(0),
+      shard_(shard),
+      map_(nullptr), map_offset_(0), map_size_(0), map_pos_(0),
+      synced_pos_(0), buffer_size_(buffer_size), inflight_count_(0),
+      writeback_pos_(0), direct_pos_(0), direct_tail_(0), raw_size_(0),
+      file_seq_(0), temp_seq_(0), next_fd_(-1), want_next_(false),
+      stop_(false), retired_count_(0), closed_count_(0), sync_error_(0),
+      bytes_(0),
+      writes_(0), write_nanos_(0), rotations_(0) {
+    // Keep chunks page aligned, mmap requires page aligned offsets.
+    size_t page = sysconf(_SC_PAGESIZE);
+    options_.mmap_chunk_size =
+        std::max(options_.mmap_chunk_size + page - 1, page) / page * page;
+
+    if (options_.inline_compress) {
+        // Frames are written whole with write(2).
+        options_.mode = FileOptions::WRITE;
+        options_.compress_threads = 0;
+    }
+
+    if (options_.mode == FileOptions::IO_URING) {
+        unsigned depth = std::max(options_.uring_depth, 1u);
+        try {
+            ring_.reset(new IoUring(depth));
+            inflight_.resize(depth);
+            inflight_offset_.resize(depth);
+        } catch (const std::system_error &) {
+            // Not supported or not permitted, use plain writes.
+            options_.mode = FileOptions::WRITE;
+        }
+    }
+
+    int fd = create_file(name_, false);
+    if (fd == -1) {
         throw std::system_error(
             std::error_code(errno, std::generic_category()));
     }
+    if (options_.mode == FileOptions::MMAP &&
+        fallocate(fd, 0, 0, options_.mmap_chunk_size) == -1 &&
+        errno == EOPNOTSUPP) {
+        // Without fallocate, page faults could hit a full disk and raise
+        // SIGBUS, use plain writes.
+        options_.mode = FileOptions::WRITE;
+        buffer_ = FixedBuffer(buffer_size);
+    }
+    start_file(fd);
+
+    if (options_.compress_threads > 0) {
+        compressor_.reset(new LogCompressor(options_.compress_threads,
+                                            options_.compress_nice));
+    }
+
+    // Prepare the second file right away.
+    want_next_ = true;
+    roller_ = std::thread(&LogFile::roller_func, this);
+}
+
+LogFile::~LogFile() {
+    flush();
+    retire_file(false); // Still the live file, leave it as is.
+
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    roller_.join();
+}
+
+int LogFile::create_file(std::string &name, bool next) {
+    // A shared writable mapping needs read access too.
+    int flags = options_.mode == FileOptions::MMAP ? O_RDWR : O_WRONLY;
+    if (options_.mode == FileOptions::DIRECT) {
+        flags |= O_DIRECT;
+    }
+
+    int fd;
+    do {
+        // Hidden from the tools until it is named, and never left empty
+        // under a log file name by a crash.
+        name = next ? path_ + ".nijika-" + std::to_string(get_pid()) + "-" +
+                          std::to_string(temp_seq_++) + ".next"
+                    : get_file_name();
+        fd = open(name.c_str(), flags | O_CREAT | O_EXCL, 0644);
+        if (fd == -1 && errno == EINVAL && (flags & O_DIRECT)) {
+            // The filesystem does not support O_DIRECT, aligned writes
+            // through the page cache still work.
+            flags &= ~O_DIRECT;
+            errno = EEXIST;
+        }
+    } while (fd == -1 && errno == EEXIST);
+
+    if (fd != -1) {
+        // Reserve the blocks up front, without changing the file size.
+        // Failing is fine, e.g. on filesystems without fallocate.
+        fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, roll_size_);
+    }
+    return fd;
+}
+
+void LogFile::start_file(int fd) {
+    fd_ = fd;
+    file_size_ = 0;
+    map_offset_ = 0;
+    map_size_ = 0;
+    map_pos_ = 0;
+    writeback_pos_ = 0;
+    direct_pos_ = 0;
+    direct_tail_ = 0;
+    if (options_.mode == FileOptions::DIRECT) {
+        buffer_.clear(); // Only the written tail of the last file is left.
+    }
+    index_.clear();
+    raw_size_ = 0;
+
+    if (header_) {
+        std::string header;
+        header_count_ = header_(header, 0);
+        if (options_.inline_compress) {
+            std::string frame;
+            build_frame(header.data(), header.size(), frame);
+            put_frame(frame, header.size());
+        } else if (options_.mode == FileOptions::MMAP) {
+            map_append(header.data(), header.size());
+        } else if (options_.mode == FileOptions::DIRECT) {
+            direct_append(header.data(), header.size());
+        } else {
+            write_all(header.data(), header.size());
+            file_size_ += header.size();
+        }
+    }
+}
+
+void LogFile::retire_file(bool compress) {
+    if (options_.inline_compress) {
+        std::string index = SeekableLz4::index_frame(index_);
+        write_all(index.data(), index.size());
+        file_size_ += index.size();
+    }
+
+    if (options_.mode == FileOptions::MMAP) {
+        unmap();
+    } else if (options_.mode == FileOptions::IO_URING) {
+        while (inflight_count_ > 0) {
+            uring_reap(true);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        retired_.push_back({fd_, file_size_, name_, compress});
+        ++retired_count_;
+    }
+    cv_.notify_one();
+}
+
+void LogFile::roller_func() {
+    std::unique_lock<std::mutex> lock(mut_);
+
+    while (true) {
+        cv_.wait(lock, [this] {
+            return stop_ || !retired_.empty() || (want_next_ && next_fd_ == -1);
+        });
+
+        std::vector<RetiredFile> retired;
+        retired.swap(retired_);
+        bool prepare = !stop_ && want_next_ && next_fd_ == -1;
+        want_next_ = false;
+        lock.unlock();
+
+        for (auto &&file : retired) {
+            // Drop the preallocated tail, then persist the finished file.
+            if (ftruncate(file.fd, file.size) == -1) {
+                // Nothing can be done, the tail is just unused space.
+            }
+            int err = fdatasync(file.fd) == -1 ? errno : 0;
+            if (err != 0) {
+                // Kept for sync, the data is not known to be on disk.
+                lock.lock();
+                sync_error_ = err;
+                lock.unlock();
+            }
+            if (options_.writeback_size > 0) {
+                posix_fadvise(file.fd, 0, 0, POSIX_FADV_DONTNEED);
+            }
+            close(file.fd);
+
+            if (file.compress && compressor_) {
+                compressor_->add(file.name);
+            }
+        }
+
+        if (!retired.empty()) {
+            // Wake up sync, the files are on disk.
+            lock.lock();
+            closed_count_ += retired.size();
+            lock.unlock();
+            closed_cv_.notify_all();
+        }
+
+        std::string name;
+        int fd = prepare ? create_file(name, true) : -1;
+
+        lock.lock();
+        if (fd != -1) {
+            next_fd_ = fd;
+            next_name_ = std::move(name);
+        }
+        // A failed preparation is retried on the next roll.
+
+        if (stop_ && retired_.empty()) {
+            break;
+        }
+    }
+
+    if (next_fd_ != -1) {
+        // Never used, do not leave an empty file behind.
+        close(next_fd_);
+        unlink(next_name_.c_str());
+        next_fd_ = -1;
+    }
 }
 
 std::string LogFile::get_file_name() {
     using namespace std::chrono;
 
+    char seq[16];
+    snprintf(seq, sizeof(seq), "%06u", file_seq_++);
+
     std::string name = path_ + "nijika-";
     name += std::to_string(get_pid()) + "-";
+    if (shard_ >= 0) {
+        name += std::to_string(shard_) + "-";
+    }
     name += to_formatted_string("%Y%m%d-%H%M%S", system_clock::now());
     name += "-";
-    name += std::to_string(1000 + rand() % 9000); // 1000-9999
-    name += ".log";
+    name += seq; // Sorts in creation order within a process.
+    name += options_.binary ? ".blog" : ".log";
+    if (options_.inline_compress) {
+        name += ".lz4";
+    }
 
     return name;
 }
 
 void LogFile::append(const char *data, size_t len) {
+    if (header_) {
+        std::string header;
+        size_t count = header_(header, header_count_);
+        if (count != header_count_) {
+            // Before the data, which may refer to it. Rolling in between
+            // is fine, the new file starts with the whole header.
+            header_count_ = count;
+            append_data(header.data(), header.size());
+        }
+    }
+
+    append_data(data, len);
+}
+
+void LogFile::append_data(const char *data, size_t len) {
+    if (options_.mode == FileOptions::MMAP) {
+        if (file_size_ + (off_t)len > roll_size_) {
+            roll();
+        }
+        map_append(data, len);
+        return;
+    }
+
+    if (options_.mode == FileOptions::DIRECT) {
+        if (file_size_ + (off_t)len > roll_size_) {
+            direct_flush();
+            roll();
+        }
+        direct_append(data, len);
+        return;
+    }
+
     if (len > buffer_.avail()) {
         flush();
     }
@@ -41,36 +308,406 @@ void LogFile::append(const char *data, size_t len) {
     buffer_.append(data, len);
 }
 
-// size_t write_to_file = 0;
+LogFile::Stats LogFile::stats() const {
+    Stats stats;
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.writes = writes_.load(std::memory_order_relaxed);
+    stats.write_nanos = write_nanos_.load(std::memory_order_relaxed);
+    stats.rotations = rotations_.load(std::memory_order_relaxed);
+    return stats;
+}
+
 void LogFile::flush() {
+    if (options_.mode == FileOptions::MMAP) {
+        // Data is already in the page cache.
+        if (options_.mmap_sync && map_ && map_pos_ > synced_pos_) {
+            size_t page = sysconf(_SC_PAGESIZE);
+            size_t begin = synced_pos_ / page * page;
+            msync(map_ + begin, map_pos_ - begin, MS_SYNC);
+            synced_pos_ = map_pos_;
+        }
+        writeback();
+        return;
+    }
+
+    if (options_.mode == FileOptions::IO_URING) {
+        uring_flush();
+        writeback();
+        return;
+    }
+
+    if (options_.mode == FileOptions::DIRECT) {
+        direct_flush();
+        return;
+    }
+
     size_t n = buffer_.bytes();
 
-    if (file_size_ + n > roll_size_) {
+    if (options_.inline_compress) {
+        if (n == 0) {
+            return;
+        }
+
+        // Compress first, the roll decision depends on the frame size.
+        build_frame(buffer_.data(), n, frame_);
+        if (file_size_ + (off_t)frame_.size() > roll_size_) {
+            roll();
+        }
+        put_frame(frame_, n);
+        buffer_.clear();
+        writeback();
+        return;
+    }
+
+    if (file_size_ + (off_t)n > roll_size_) {
         roll();
     }
 
+    write_all(buffer_.data(), n);
+
+    file_size_ += n;
+    buffer_.clear();
+    writeback();
+}
+
+void LogFile::wait_writes() {
+    flush();
+
+    if (options_.mode == FileOptions::IO_URING) {
+        while (inflight_count_ > 0) {
+            uring_reap(true);
+        }
+    }
+}
+
+int LogFile::sync() {
+    wait_writes();
+
+    // Also covers pages dirtied through the mapping in MMAP mode.
+    int err = fdatasync(fd_) == -1 ? errno : 0;
+
+    // Rotated files are synced by the roller thread before closing.
+    std::unique_lock<std::mutex> lock(mut_);
+    uint64_t retired = retired_count_;
+    closed_cv_.wait(lock, [&] { return closed_count_ >= retired; });
+    if (err == 0) {
+        err = sync_error_;
+    }
+    sync_error_ = 0;
+
+    return err;
+}
+
+void LogFile::build_frame(const char *data, size_t len, std::string &frame) {
+    frame.clear(); // Keeps the capacity.
+    frame += Lz4::frame_header(len);
+    for (size_t off = 0; off < len; off += Lz4::MAX_BLOCK_SIZE) {
+        Lz4::frame_block(frame, data + off,
+                         std::min(Lz4::MAX_BLOCK_SIZE, len - off));
+    }
+    frame += Lz4::frame_end();
+}
+
+void LogFile::put_frame(const std::string &frame, size_t raw_len) {
+    index_.push_back({(uint64_t)file_size_, raw_size_});
+    write_all(frame.data(), frame.size());
+    file_size_ += frame.size();
+    raw_size_ += raw_len;
+}
+
+void LogFile::direct_append(const char *data, size_t len) {
+    while (len > 0) {
+        if (buffer_.avail() == 0) {
+            direct_flush();
+        }
+
+        size_t n = std::min(len, buffer_.avail());
+        buffer_.append(data, n);
+        file_size_ += n;
+        data += n;
+        len -= n;
+    }
+}
+
+void LogFile::direct_flush() {
+    size_t n = buffer_.bytes();
+    if (n == direct_tail_) {
+        return;
+    }
+
+    // The capacity is a multiple of DIRECT_ALIGN, so the padding fits.
+    size_t padded = (n + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+    memset(buffer_.current(), 0, padded - n);
+    pwrite_all(buffer_.data(), padded, direct_pos_);
+
+    // Keep the partial page, it is rewritten with more data next time. The
+    // padding is truncated away when the file is closed.
+    size_t full = n / DIRECT_ALIGN * DIRECT_ALIGN;
+    buffer_.discard(full);
+    direct_pos_ += full;
+    direct_tail_ = n - full;
+}
+
+void LogFile::writeback() {
+    off_t chunk = options_.writeback_size;
+    if (chunk == 0) {
+        return;
+    }
+
+    while (file_size_ - writeback_pos_ >= chunk) {
+        sync_file_range(fd_, writeback_pos_, chunk, SYNC_FILE_RANGE_WRITE);
+
+        // The previous range had a whole chunk of time to be written back,
+        // so waiting for it rarely blocks.
+        if (writeback_pos_ >= chunk) {
+            off_t prev = writeback_pos_ - chunk;
+            sync_file_range(fd_, prev, chunk,
+                            SYNC_FILE_RANGE_WAIT_BEFORE |
+                                SYNC_FILE_RANGE_WRITE |
+                                SYNC_FILE_RANGE_WAIT_AFTER);
+            if (map_) {
+                // Mapped pages stay in the page cache, unmap the written
+                // back pages of the chunk first. (MMAP mode)
+                off_t page = sysconf(_SC_PAGESIZE);
+                off_t begin = std::max(prev, map_offset_);
+                begin = (begin + page - 1) / page * page;
+                off_t end = (prev + chunk) / page * page;
+                if (begin < end) {
+                    madvise(map_ + (begin - map_offset_), end - begin,
+                            MADV_DONTNEED);
+                }
+            }
+            posix_fadvise(fd_, prev, chunk, POSIX_FADV_DONTNEED);
+        }
+
+        writeback_pos_ += chunk;
+    }
+}
+
+void LogFile::count_writes(std::chrono::steady_clock::time_point begin,
+                           size_t len, uint64_t calls) {
+    auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count();
+
+    // Only this thread writes them, no atomic read-modify-write needed.
+    bytes_.store(bytes_.load(std::memory_order_relaxed) + len,
+                 std::memory_order_relaxed);
+    writes_.store(writes_.load(std::memory_order_relaxed) + calls,
+                  std::memory_order_relaxed);
+    write_nanos_.store(write_nanos_.load(std::memory_order_relaxed) + nanos,
+                       std::memory_order_relaxed);
+}
+
+void LogFile::write_all(const char *data, size_t len) {
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t calls = 0;
+
+    size_t written = 0;
+    while (written < len) {
+        ssize_t res = write(fd_, data + written, len - written);
+        ++calls;
+        if (res == -1) {
+            int ec = errno;
+            if (ec == EINTR) {
+                continue;
+            }
+            count_writes(begin, written, calls);
+            throw std::system_error(ec, std::generic_category());
+        }
+        written += res;
+    }
+
+    count_writes(begin, written, calls);
+}
+
+void LogFile::pwrite_all(const char *data, size_t len, off_t offset) {
+    auto begin = std::chrono::steady_clock::now();
+    uint64_t calls = 0;
+
     size_t written = 0;
-    while (written < n) {
-        ssize_t res = write(fd_, buffer_.data() + written, n - written);
+    while (written < len) {
+        ssize_t res = pwrite(fd_, data + written, len - written,
+                             offset + written);
+        ++calls;
         if (res == -1) {
             int ec = errno;
             if (ec == EINTR) {
                 continue;
             }
+            count_writes(begin, written, calls);
             throw std::system_error(ec, std::generic_category());
         }
         written += res;
     }
 
-    // write_to_file += n;
+    count_writes(begin, written, calls);
+}
+
+void LogFile::uring_flush() {
+    size_t n = buffer_.bytes();
+    if (n == 0) {
+        uring_reap(false);
+        return;
+    }
+
+    if (file_size_ + (off_t)n > roll_size_) {
+        roll();
+    }
+
+    while (inflight_count_ == inflight_.size()) {
+        uring_reap(true);
+    }
+
+    size_t slot = 0;
+    while (inflight_[slot]) {
+        ++slot;
+    }
+
+    // The queue is as deep as inflight_, so there is always a free entry.
+    auto begin = std::chrono::steady_clock::now();
+    ring_->write(fd_, buffer_.data(), n, file_size_, slot);
+    ring_->submit();
+    count_writes(begin, 0, 1); // Bytes are counted on completion.
+
+    inflight_[slot] = std::move(buffer_);
+    inflight_offset_[slot] = file_size_;
+    ++inflight_count_;
     file_size_ += n;
-    buffer_.clear();
+
+    uring_reap(false);
+    if (!idle_.empty()) {
+        buffer_ = std::move(idle_.back());
+        idle_.pop_back();
+    } else {
+        buffer_ = FixedBuffer(buffer_size_);
+    }
+}
+
+void LogFile::uring_reap(bool wait) {
+    if (wait) {
+        auto begin = std::chrono::steady_clock::now();
+        ring_->submit(1);
+        count_writes(begin, 0, 1);
+    }
+
+    uint64_t slot;
+    int res;
+    while (ring_->reap(&slot, &res)) {
+        FixedBuffer &buf = inflight_[slot];
+
+        // Finish short or failed writes synchronously, this also covers
+        // kernels without IORING_OP_WRITE.
+        size_t done = res > 0 ? res : 0;
+        bytes_.store(bytes_.load(std::memory_order_relaxed) + done,
+                     std::memory_order_relaxed);
+        if (done < buf.bytes()) {
+            pwrite_all(buf.data() + done, buf.bytes() - done,
+                       inflight_offset_[slot] + done);
+        }
+
+        buf.clear();
+        idle_.emplace_back(std::move(buf));
+        --inflight_count_;
+    }
+}
+
+void LogFile::map_append(const char *data, size_t len) {
+    while (len > 0) {
+        if (map_pos_ == map_size_) {
+            map_next();
+        }
+
+        size_t n = std::min(len, map_size_ - map_pos_);
+        memcpy(map_ + map_pos_, data, n);
+        map_pos_ += n;
+        file_size_ += n;
+        bytes_.store(bytes_.load(std::memory_order_relaxed) + n,
+                     std::memory_order_relaxed);
+        data += n;
+        len -= n;
+    }
+}
+
+void LogFile::map_next() {
+    unmap();
+
+    map_offset_ += map_size_;
+    map_size_ = options_.mmap_chunk_size;
+    map_pos_ = 0;
+    synced_pos_ = 0;
+
+    // Allocate blocks up front, so page faults never hit a full disk.
+    if (fallocate(fd_, 0, map_offset_, map_size_) == -1) {
+        map_size_ = 0;
+        throw std::system_error(errno, std::generic_category());
+    }
+
+    void *addr = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      fd_, map_offset_);
+    if (addr == MAP_FAILED) {
+        map_size_ = 0;
+        throw std::system_error(errno, std::generic_category());
+    }
+    map_ = (char *)addr;
+    madvise(map_, map_size_, MADV_SEQUENTIAL); // Written front to back.
+}
+
+void LogFile::unmap() {
+    if (!map_) {
+        return;
+    }
+
+    if (options_.mmap_sync) {
+        msync(map_, map_pos_, MS_SYNC);
+    }
+    munmap(map_, map_size_);
+    map_ = nullptr;
 }
 
 void LogFile::roll() {
-    close(fd_);
-    file_size_ = 0;
-    fd_ = open(get_file_name().c_str(), O_WRONLY | O_CREAT, 0644);
+    int fd;
+    std::string temp;
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        fd = next_fd_;
+        temp = std::move(next_name_);
+        next_fd_ = -1;
+        want_next_ = true;
+    }
+    cv_.notify_one();
+
+    // Named now, so the name carries the time of the roll.
+    std::string name;
+    if (fd != -1) {
+        int res;
+        do {
+            name = get_file_name();
+            res = renameat2(AT_FDCWD, temp.c_str(), AT_FDCWD, name.c_str(),
+                            RENAME_NOREPLACE);
+            if (res == -1 && errno == EINVAL) {
+                // Not supported by the filesystem.
+                res = rename(temp.c_str(), name.c_str());
+            }
+        } while (res == -1 && errno == EEXIST);
+
+        if (res == -1) {
+            close(fd);
+            unlink(temp.c_str());
+            fd = -1;
+        }
+    }
+
+    if (fd == -1) {
+        // The next file is not ready yet, keep writing the current one
+        // rather than stalling.
+        return;
+    }
+
+    retire_file(true);
+    name_ = std::move(name);
+    start_file(fd);
+    rotations_.fetch_add(1, std::memory_order_relaxed);
 }
 
 } // namespace log
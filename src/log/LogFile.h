@@ -1,10 +1,21 @@
 #pragma once
 
+#include "log/LogCompressor.h"
+#include "log/Logger.h"
 #include "util/FixedBuffer.h"
+#include "util/IoUring.h"
+#include "util/SeekableLz4.h"
 #include "util/Noncopyable.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <fcntl.h>
 #include <string.h>
@@ -17,23 +28,39 @@ namespace log {
 using namespace util;
 
 /**
- * Buffered log file class. Supports log roatation.
+ * Buffered, memory-mapped or io_uring backed log file class. Supports log
+ * roatation. A background thread opens and preallocates the next file ahead
+ * of time and closes rotated files, so rolling is only a rename and a
+ * descriptor swap.
  * @thread-safety: unsafe.
  */
 class LogFile : Noncopyable {
   public:
+    /**
+     * Produces the data written at the beginning of every log file. Called
+     * again before each append, it appends the entries added since, e.g.
+     * definitions the data refers to, so each append must hold whole
+     * records.
+     * @param out: receives the data.
+     * @param from: entries already written to the file, 0 for a new file.
+     * @return: entries written so far.
+     */
+    using header_func = size_t (*)(std::string &out, size_t from);
+
     /**
      * Constructor.
      * @param path: log file path.
      * @param roll_size: log roll path.
      * @param buffer_size: internal buffer size.
+     * @param options: log file options.
+     * @param header: file header producer, nullptr for no header.
+     * @param shard: writer shard added to file names, -1 for none.
      */
-    LogFile(const std::string &path, off_t roll_size, size_t buffer_size);
+    LogFile(const std::string &path, off_t roll_size, size_t buffer_size,
+            const FileOptions &options = FileOptions(),
+            header_func header = nullptr, int shard = -1);
 
-    ~LogFile() {
-        flush();
-        close(fd_);
-    }
+    ~LogFile();
 
     /**
      * Appends data to the file, possibly flushing the buffer to hold it.
@@ -60,27 +87,242 @@ class LogFile : Noncopyable {
      */
     void flush();
 
+    /**
+     * Flushes the buffer, then waits until everything appended so far is
+     * written to the file, which only takes waiting in IO_URING mode.
+     */
+    void wait_writes();
+
+    /**
+     * Flushes the buffer, then waits until everything appended so far,
+     * rotated files included, is on disk. (fdatasync)
+     * @return: 0, or the errno of a failed fdatasync, of this file or of a
+     * rotated one since the last call. The data is then not known to be on
+     * disk.
+     */
+    int sync();
+
+    /**
+     * Counters of the file output, see Logger::Stats.
+     */
+    struct Stats {
+        uint64_t bytes;       // Bytes written out.
+        uint64_t writes;      // write(2), pwrite(2) and io_uring waits.
+        uint64_t write_nanos; // Time spent in them.
+        uint64_t rotations;   // Files rolled.
+    };
+
+    /**
+     * @return: a snapshot of the counters, safe to call from any thread.
+     */
+    Stats stats() const;
+
+    /**
+     * @return: a snapshot of the counters of the compression of rotated files.
+     */
+    Logger::CompressionStats compression_stats() const {
+        return compressor_ ? compressor_->stats() : Logger::CompressionStats();
+    }
+
   private:
-    int fd_;             // Current file descriptor.
-    off_t file_size_;    // Current file size.
-    off_t roll_size_;    // Log file maximum size.
-    FixedBuffer buffer_; // Internal buffer.
-    std::string path_;   // Log file path.
+    static constexpr size_t DIRECT_ALIGN = 4096; // O_DIRECT alignment.
+
+    int fd_;              // Current file descriptor.
+    off_t file_size_;     // Current file size.
+    off_t roll_size_;     // Log file maximum size.
+    FixedBuffer buffer_;  // Internal buffer.
+    std::string path_;    // Log file path.
+    std::string name_;    // Name of the current file.
+    FileOptions options_; // Log file options.
+    header_func header_;  // File header producer.
+    size_t header_count_; // Header entries in the current file.
+    int shard_;           // Writer shard in file names, -1 for none.
+
+    char *map_;         // Current mapped chunk. (MMAP mode)
+    off_t map_offset_;  // File offset of the chunk.
+    size_t map_size_;   // Size of the chunk.
+    size_t map_pos_;    // Write position in the chunk.
+    size_t synced_pos_; // Position synced by mmap_sync.
+
+    std::unique_ptr<IoUring> ring_;      // (IO_URING mode)
+    size_t buffer_size_;                 // Size of each buffer.
+    std::vector<FixedBuffer> inflight_;  // Buffers being written, by slot.
+    std::vector<off_t> inflight_offset_; // File offsets of the buffers.
+    size_t inflight_count_;              // Number of buffers in flight.
+    std::vector<FixedBuffer> idle_;      // Written buffers for reuse.
+
+    off_t writeback_pos_; // End of the range whose writeback was started.
+    off_t direct_pos_;    // File offset of the buffer. (DIRECT mode)
+    size_t direct_tail_;  // Buffered bytes already written, as padded page.
+
+    std::string frame_;                       // Compressed frame.
+    std::vector<SeekableLz4::Frame> index_;   // Frames of the current file.
+    uint64_t raw_size_;                       // Uncompressed size of the file.
+
+    unsigned file_seq_; // Sequence number of the next file name.
+    unsigned temp_seq_; // Of the next temporary name. (roller thread)
+
+    std::thread roller_;     // Prepares and retires files.
+    std::mutex mut_;         // Guards the fields below.
+    std::condition_variable cv_;
+    int next_fd_;            // Prepared next file, -1 if not ready.
+    std::string next_name_;  // Temporary name of the prepared file.
+    bool want_next_;         // Whether a next file is requested.
+    bool stop_;              // Stops the roller thread.
+    uint64_t retired_count_; // Files handed to the roller thread.
+    uint64_t closed_count_;  // Files it has synced and closed.
+    int sync_error_;         // Of a closed file, 0 once reported by sync.
+    std::condition_variable closed_cv_; // For waiting on closed_count_.
+
+    // A file handed to the roller thread.
+    struct RetiredFile {
+        int fd;
+        off_t size;       // Real size, the rest is preallocated.
+        std::string name;
+        bool compress;    // Whether to compress it after closing.
+    };
+    std::vector<RetiredFile> retired_; // Files to close.
+
+    std::unique_ptr<LogCompressor> compressor_; // Compresses rotated files.
+
+    std::atomic<uint64_t> bytes_;       // See Stats.
+    std::atomic<uint64_t> writes_;      // See Stats.
+    std::atomic<uint64_t> write_nanos_; // See Stats.
+    std::atomic<uint64_t> rotations_;   // See Stats.
 
     /**
-     * Generates a file name according to current log path, pid and timestamp.
+     * Generates a file name according to current log path, pid, shard and
+     * timestamp.
      * @return: a full path to the log file.
      */
     std::string get_file_name();
 
     /**
-     * Opens a new log file.
+     * Creates and preallocates a new log file.
+     * @param name: receives the file name.
+     * @param next: creates the next file under a hidden temporary name, it
+     * is named when it becomes current, see roll.
+     * @return: the file descriptor, -1 on failure.
+     */
+    int create_file(std::string &name, bool next);
+
+    /**
+     * Makes a created file current and writes the file header.
+     * @param fd: file descriptor of the file.
+     */
+    void start_file(int fd);
+
+    /**
+     * Appends data to the current file, rolling it as needed.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     */
+    void append_data(const char *data, size_t len);
+
+    /**
+     * Hands the current file to the roller thread for closing.
+     * @param compress: whether to compress the file after closing.
+     */
+    void retire_file(bool compress);
+
+    /**
+     * Roller thread function.
+     */
+    void roller_func();
+
+    /**
+     * Copies data into the mapping, mapping more chunks as needed.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     */
+    void map_append(const char *data, size_t len);
+
+    /**
+     * Grows the file by one chunk and maps it.
+     */
+    void map_next();
+
+    /**
+     * Unmaps the current chunk.
+     */
+    void unmap();
+
+    /**
+     * Submits the buffer as an io_uring write and takes a fresh buffer.
+     */
+    void uring_flush();
+
+    /**
+     * Recycles the buffers of completed writes.
+     * @param wait: wait for at least one completion.
+     */
+    void uring_reap(bool wait);
+
+    /**
+     * Appends data to the aligned buffer, flushing it as needed.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     */
+    void direct_append(const char *data, size_t len);
+
+    /**
+     * Writes the aligned buffer padded to whole pages, then keeps the last
+     * partial page at the front of the buffer.
+     */
+    void direct_flush();
+
+    /**
+     * Compresses data into a frame. (inline_compress)
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     * @param frame: receives the frame.
+     */
+    static void build_frame(const char *data, size_t len, std::string &frame);
+
+    /**
+     * Writes a frame and records it in the index.
+     * @param frame: the frame.
+     * @param raw_len: uncompressed size of the frame.
+     */
+    void put_frame(const std::string &frame, size_t raw_len);
+
+    /**
+     * Starts writeback of newly written data and drops the range before it
+     * from the page cache, every writeback_size bytes.
+     */
+    void writeback();
+
+    /**
+     * Counts writes.
+     * @param begin: start time of the writes.
+     * @param len: bytes written.
+     * @param calls: number of system calls.
+     */
+    void count_writes(std::chrono::steady_clock::time_point begin, size_t len,
+                      uint64_t calls);
+
+    /**
+     * Writes data to the current file, retrying on partial writes.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     */
+    void write_all(const char *data, size_t len);
+
+    /**
+     * Writes data at the offset, retrying on partial writes.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     * @param offset: file offset.
+     */
+    void pwrite_all(const char *data, size_t len, off_t offset);
+
+    /**
+     * Switches to the prepared next file, naming it after the time of the
+     * roll. Keeps the current file if it is not ready yet.
      */
     void roll();
 };
 
-// extern size_t write_to_file;
-
 } // namespace log
 
 } // namespace nijika
\ No newline at end of file
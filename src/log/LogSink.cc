@@ -0,0 +1,163 @@
+#include "log/LogSink.h"
+#include "log/BinaryLog.h"
+#include "log/LogFile.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace log {
+
+std::chrono::milliseconds UnixSocketSink::DEFAULT_RETRY_INTERVAL(1000);
+
+FileSink::FileSink(const std::string &path, off_t roll_size,
+                   size_t buffer_size, const FileOptions &options)
+    : file_(std::make_unique<LogFile>(
+          path, roll_size, buffer_size, options,
+          options.binary ? &BinaryLog::file_header : nullptr)) {}
+
+FileSink::~FileSink() = default;
+
+void FileSink::write(const char *data, size_t len) { file_->append(data, len); }
+
+void FileSink::flush() { file_->flush(); }
+
+void StderrSink::write(const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t res = ::write(STDERR_FILENO, data, len);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += res;
+        len -= res;
+    }
+}
+
+UnixSocketSink::UnixSocketSink(const std::string &path,
+                               std::chrono::milliseconds retry_interval)
+    : path_(path), retry_interval_(retry_interval), fd_(-1),
+      dropped_bytes_(0) {}
+
+UnixSocketSink::~UnixSocketSink() { disconnect(); }
+
+bool UnixSocketSink::connect() {
+    if (fd_ != -1) {
+        return true;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now < next_retry_) {
+        return false;
+    }
+    next_retry_ = now + retry_interval_;
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path_.size() >= sizeof(addr.sun_path)) {
+        return false;
+    }
+    memcpy(addr.sun_path, path_.data(), path_.size());
+
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ == -1) {
+        return false;
+    }
+
+    // A collector that stops reading must not hang the sink thread, which
+    // would also hang the exit of the process. Also bounds connect, which
+    // waits while the listen backlog is full.
+    timeval tv;
+    tv.tv_sec = retry_interval_.count() / 1000;
+    tv.tv_usec = retry_interval_.count() % 1000 * 1000;
+    setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (::connect(fd_, (sockaddr *)&addr, sizeof(addr)) == -1) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void UnixSocketSink::disconnect() {
+    if (fd_ != -1) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void UnixSocketSink::write(const char *data, size_t len) {
+    while (len > 0) {
+        if (!connect()) {
+            dropped_bytes_.fetch_add(len, std::memory_order_relaxed);
+            return;
+        }
+
+        // MSG_NOSIGNAL: a vanished collector must not raise SIGPIPE.
+        ssize_t res = send(fd_, data, len, MSG_NOSIGNAL);
+        if (res == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Send timed out, drop the data and resynchronize lines on
+                // a new connection.
+                dropped_bytes_.fetch_add(len, std::memory_order_relaxed);
+                disconnect();
+                return;
+            }
+            // The rest of a cut line goes to the next connection, which
+            // is fine for a collector splitting on newlines.
+            disconnect();
+            continue;
+        }
+        data += res;
+        len -= res;
+    }
+}
+
+MemorySink::MemorySink(size_t capacity)
+    : ring_(std::max(capacity, (size_t)1), '\0'), pos_(0), full_(false) {}
+
+void MemorySink::write(const char *data, size_t len) {
+    std::lock_guard<std::mutex> lock(mut_);
+
+    if (len >= ring_.size()) {
+        // Only the tail survives.
+        data += len - ring_.size();
+        len = ring_.size();
+    }
+
+    size_t first = std::min(len, ring_.size() - pos_);
+    memcpy(&ring_[pos_], data, first);
+    memcpy(&ring_[0], data + first, len - first);
+
+    pos_ += len;
+    if (pos_ >= ring_.size()) {
+        pos_ -= ring_.size();
+        full_ = true;
+    }
+}
+
+std::string MemorySink::snapshot() const {
+    std::lock_guard<std::mutex> lock(mut_);
+
+    if (!full_) {
+        return ring_.substr(0, pos_);
+    }
+    return ring_.substr(pos_) + ring_.substr(0, pos_);
+}
+
+} // namespace log
+
+} // namespace nijika
@@ -0,0 +1,161 @@
+/**
+ * This is a public header.
+ */
+
+#pragma once
+
+#include "log/Logger.h"
+#include "util/Noncopyable.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace nijika {
+
+namespace log {
+
+class LogFile;
+
+using namespace util;
+
+/**
+ * Destination of log data besides the main log file. Every sink added with
+ * Logger::add_sink is driven by its own thread and queue, so a slow sink
+ * never stalls the others. Sinks receive the same bytes as the main log
+ * file, i.e. binary records when FileOptions::binary is set.
+ * @thread-safety: write and flush are only called by the sink thread.
+ */
+class LogSink : Noncopyable {
+  public:
+    virtual ~LogSink() = default;
+
+    /**
+     * Writes data to the sink.
+     * @param data: pointer to the data, whole log lines.
+     * @param len: size of the data.
+     */
+    virtual void write(const char *data, size_t len) = 0;
+
+    /**
+     * Flushes data buffered by the sink, called after every drain.
+     */
+    virtual void flush() {}
+};
+
+/**
+ * Rotating log file, e.g. a separate file of severe lines.
+ */
+class FileSink : public LogSink {
+  public:
+    /**
+     * Constructor.
+     * @param path: log file path, a directory or prefix other than the main
+     * log file's. Both name files nijika-pid-date-time-seq with their own
+     * seq, so the same path can give both the same name.
+     * @param roll_size: log file roll size.
+     * @param buffer_size: internal buffer size.
+     * @param options: log file options. binary must match the main log
+     * file's.
+     */
+    explicit FileSink(const std::string &path,
+                      off_t roll_size = Logger::DEFAULT_ROLL_SIZE,
+                      size_t buffer_size = Logger::DEFAULT_SINK_BUFFER_SIZE,
+                      const FileOptions &options = FileOptions());
+
+    ~FileSink() override;
+
+    void write(const char *data, size_t len) override;
+
+    void flush() override;
+
+  private:
+    std::unique_ptr<LogFile> file_;
+};
+
+/**
+ * Standard error.
+ */
+class StderrSink : public LogSink {
+  public:
+    void write(const char *data, size_t len) override;
+};
+
+/**
+ * Stream connection to a Unix domain socket, e.g. a local log collector.
+ * Connects lazily and reconnects after errors, data written while the
+ * collector is unreachable is dropped and counted.
+ */
+class UnixSocketSink : public LogSink {
+  public:
+    static std::chrono::milliseconds DEFAULT_RETRY_INTERVAL;
+
+    /**
+     * Constructor.
+     * @param path: path of the socket.
+     * @param retry_interval: minimum time between connection attempts.
+     */
+    explicit UnixSocketSink(
+        const std::string &path,
+        std::chrono::milliseconds retry_interval = DEFAULT_RETRY_INTERVAL);
+
+    ~UnixSocketSink() override;
+
+    void write(const char *data, size_t len) override;
+
+    /**
+     * @return: bytes dropped while disconnected.
+     */
+    uint64_t dropped_bytes() const noexcept { return dropped_bytes_; }
+
+  private:
+    std::string path_;                         // Path of the socket.
+    std::chrono::milliseconds retry_interval_; // Between connection attempts.
+    std::chrono::steady_clock::time_point next_retry_; // Next attempt.
+    int fd_;                                   // -1 when disconnected.
+    std::atomic<uint64_t> dropped_bytes_;      // See dropped_bytes.
+
+    /**
+     * Connects unless connected or retrying too soon.
+     * @return: true if connected.
+     */
+    bool connect();
+
+    /**
+     * Closes the connection.
+     */
+    void disconnect();
+};
+
+/**
+ * In-memory ring holding the most recent log data, e.g. for crash reports
+ * or a debug endpoint.
+ */
+class MemorySink : public LogSink {
+  public:
+    /**
+     * Constructor.
+     * @param capacity: size of the ring.
+     */
+    explicit MemorySink(size_t capacity);
+
+    void write(const char *data, size_t len) override;
+
+    /**
+     * @return: a copy of the data in the ring, oldest first. The first
+     * line may be cut.
+     */
+    std::string snapshot() const;
+
+  private:
+    mutable std::mutex mut_; // Guards the fields below.
+    std::string ring_;       // Ring storage.
+    size_t pos_;             // Next write position.
+    bool full_;              // Ring has wrapped.
+};
+
+} // namespace log
+
+} // namespace nijika
@@ -1,49 +1,276 @@
 #include "log/LogStream.h"
+#include "util/Json.h"
+#include "util/NumberFormat.h"
 #include "util/ProcessInfo.h"
 #include "util/TimeUtil.h"
 
+#include <cstdint>
 #include <chrono>
 
 namespace nijika {
 
 namespace log {
 
+// Large enough for any integer, pointer or floating point number.
+static constexpr size_t MAX_NUMERIC_SIZE = NumberFormat::MAX_SIZE;
+
+namespace {
+
+/**
+ * Stream buffer writing into a caller provided region, dropping overflow.
+ */
+class RegionBuf : public std::streambuf {
+  public:
+    void reset(char *begin, char *end) { setp(begin, end); }
+    char *pos() const { return pptr(); }
+
+  protected:
+    int_type overflow(int_type) override { return traits_type::eof(); }
+};
+
+} // namespace
+
 LogStream::LogStream(Logger::level level)
-    : level(level), std::stringstream(std::ios::out | std::ios::ate),
-      tid(std::to_string(get_tid())) {}
+    : level(level), tid(std::to_string(get_tid())), format_(Logger::TEXT),
+      escape_(false), quoted_(false), cut_(false), durable_(false),
+      field_begin_(0) {}
 
 LogStream::~LogStream() { flush(); }
 
 void LogStream::flush() {
-    if (str().size() == 0) {
+    if (buf_.empty()) {
+        return;
+    }
+
+    if (Logger::enabled(level)) {
+        if (format_ != Logger::TEXT) {
+            // Close the message, the room kept for the tail and the fields
+            // guarantees they fit.
+            buf_.append("\"", 1);
+            buf_.append(fields_.data(), fields_.bytes());
+            if (format_ == Logger::JSON) {
+                buf_.append("}", 1);
+            }
+        }
+        buf_.append("\n", 1);
+        Logger::get_instance().write(buf_.data(), buf_.bytes(), level,
+                                     durable_);
+    }
+
+    // Lines below the runtime threshold are discarded.
+    buf_.clear();
+    fields_.clear();
+    format_ = Logger::TEXT;
+    escape_ = false;
+    durable_ = false;
+}
+
+LogStream &LogStream::append_escaped(const char *data, size_t len) {
+    size_t consumed;
+    buf_.add(Json::escape(buf_.current(), room(), data, len, consumed));
+    cut_ = cut_ || consumed < len;
+    return *this;
+}
+
+void LogStream::begin_field(std::string_view key, bool quoted) {
+    escape_ = false;
+    cut_ = false;
+    field_begin_ = buf_.bytes();
+    quoted_ = quoted && format_ != Logger::TEXT;
+
+    if (format_ == Logger::JSON) {
+        append(",\"", 2);
+        append_escaped(key.data(), key.size());
+        append(quoted_ ? "\":\"" : "\":", quoted_ ? 3 : 2);
+    } else {
+        append(" ", 1);
+        append(key.data(), key.size());
+        append(quoted_ ? "=\"" : "=", quoted_ ? 2 : 1);
+    }
+    escape_ = quoted_;
+}
+
+void LogStream::end_field() {
+    escape_ = false;
+    if (format_ == Logger::TEXT) {
+        return;
+    }
+
+    // A field filling the line may have been cut, drop it whole.
+    if (!cut_ && room() > (size_t)quoted_) {
+        if (quoted_) {
+            append("\"", 1);
+        }
+        fields_.append(buf_.data() + field_begin_,
+                       buf_.bytes() - field_begin_);
+    }
+    buf_.resize(field_begin_);
+    escape_ = true; // Back in the message.
+}
+
+template <typename T> LogStream &LogStream::format_integer(T v) {
+    if (room() >= MAX_NUMERIC_SIZE) {
+        // Fast path, format in place.
+        char *end = NumberFormat::integer(buf_.current(), v);
+        buf_.add(end - buf_.current());
+        return *this;
+    }
+
+    char tmp[MAX_NUMERIC_SIZE];
+    char *end = NumberFormat::integer(tmp, v);
+    return append(tmp, end - tmp);
+}
+
+template <typename T> LogStream &LogStream::format_float(T v) {
+    // Shortest round trip, so no precision is lost.
+    if (room() >= MAX_NUMERIC_SIZE) {
+        char *end = NumberFormat::floating(buf_.current(), v);
+        buf_.add(end - buf_.current());
+        return *this;
+    }
+
+    char tmp[MAX_NUMERIC_SIZE];
+    char *end = NumberFormat::floating(tmp, v);
+    return append(tmp, end - tmp);
+}
+
+LogStream &LogStream::operator<<(short v) { return format_integer(v); }
+LogStream &LogStream::operator<<(unsigned short v) { return format_integer(v); }
+LogStream &LogStream::operator<<(int v) { return format_integer(v); }
+LogStream &LogStream::operator<<(unsigned int v) { return format_integer(v); }
+LogStream &LogStream::operator<<(long v) { return format_integer(v); }
+LogStream &LogStream::operator<<(unsigned long v) { return format_integer(v); }
+LogStream &LogStream::operator<<(long long v) { return format_integer(v); }
+LogStream &LogStream::operator<<(unsigned long long v) {
+    return format_integer(v);
+}
+
+LogStream &LogStream::operator<<(float v) { return format_float(v); }
+LogStream &LogStream::operator<<(double v) { return format_float(v); }
+LogStream &LogStream::operator<<(long double v) { return format_float(v); }
+
+LogStream &LogStream::operator<<(const void *p) {
+    char tmp[MAX_NUMERIC_SIZE];
+    char *end = NumberFormat::pointer(tmp, (uintptr_t)p);
+    return append(tmp, end - tmp);
+}
+
+LogStream &LogStream::operator<<(Hex v) {
+    char tmp[MAX_NUMERIC_SIZE] = {'0', 'x'};
+    char *end = NumberFormat::hex(tmp + 2, v.value);
+    return append(tmp, end - tmp);
+}
+
+LogStream &LogStream::operator<<(const NewLineBase &nl) { return nl(*this); }
+
+LogStream &LogStream::operator<<(Suppressed s) {
+    if (s.count == 0) {
+        return *this;
+    }
+    if (format_ == Logger::TEXT) {
+        return *this << "[SUPPRESSED: " << s.count << "] ";
+    }
+    return *this << kv("suppressed", s.count);
+}
+
+static thread_local RegionBuf region_buf;
+static thread_local std::ostream region_stream(&region_buf);
+
+std::ostream &LogStream::begin_ostream() {
+    region_buf.reset(buf_.current(), buf_.current() + room());
+    region_stream.clear();
+    return region_stream;
+}
+
+void LogStream::end_ostream() {
+    size_t len = region_buf.pos() - buf_.current();
+    if (!escape_ || Json::find_escape(buf_.current(), len) == len) {
+        buf_.add(len);
         return;
     }
 
-    *this << '\n';
-    Logger::get_instance().write(str());
-    str("");
+    // Escape the formatted text, which is still in the free space.
+    char tmp[LINE_SIZE];
+    memcpy(tmp, buf_.current(), len);
+    append_escaped(tmp, len);
+}
+
+/**
+ * @return: a JSON string literal.
+ */
+static std::string quote(std::string_view s) {
+    std::string out(s.size() * Json::MAX_ESCAPE_SIZE + 2, '\0');
+    size_t consumed;
+    size_t len = Json::escape(&out[1], out.size() - 2, s.data(), s.size(),
+                              consumed);
+    out[0] = '"';
+    out[len + 1] = '"';
+    out.resize(len + 2);
+    return out;
 }
 
-LogStream &operator<<(LogStream &ls, const NewLineBase &nl) { return nl(ls); }
+/**
+ * @return: a logfmt value, quoted only if needed.
+ */
+static std::string logfmt_value(std::string_view s) {
+    if (!s.empty() && s.find_first_of(" =") == std::string_view::npos &&
+        Json::find_escape(s.data(), s.size()) == s.size()) {
+        return std::string(s);
+    }
+    return quote(s);
+}
 
-NewLine::NewLine(const std::string &file, const std::string &func, int line) {
-    using namespace std::chrono;
+SourceSite::SourceSite(const char *file, const char *func, int line)
+    : file(file), func(func), line(line) {
+    std::string line_str = std::to_string(line);
 
-    context_ += "[FILE: " + file + "]";
-    context_ += "[FUNC: " + func + "]";
-    context_ += "[LINE: " + std::to_string(line) + "]";
+    std::string &text = contexts_[Logger::TEXT];
+    text += "[FILE: ";
+    text += file;
+    text += "][FUNC: ";
+    text += func;
+    text += "][LINE: " + line_str + "]";
 
-    auto now = system_clock::now();
-    auto usec =
-        duration_cast<microseconds>(now.time_since_epoch()).count() % 1000000;
-    context_ +=
-        "[" + to_formatted_string("%F %T.", now) + std::to_string(usec) + "] ";
+    contexts_[Logger::LOGFMT] = " file=" + logfmt_value(file) +
+                                " func=" + logfmt_value(func) +
+                                " line=" + line_str;
+
+    contexts_[Logger::JSON] = ",\"file\":" + quote(file) +
+                              ",\"func\":" + quote(func) +
+                              ",\"line\":" + line_str;
+}
+
+NewLine::NewLine(const SourceSite &site) : site_(site) {
+    Logger::get_instance().format_timestamp(time_,
+                                            std::chrono::system_clock::now());
 }
 
 LogStream &NewLine::operator()(LogStream &ls) const {
     ls.flush();
-    ls << "[" << Logger::level_str[ls.level] << "]"
-       << "[TID: " << ls.tid << "]" << context_;
+
+    Logger::line_format format = Logger::get_instance().format();
+    switch (format) {
+    case Logger::TEXT:
+        ls << "[" << Logger::level_str[ls.level] << "]"
+           << "[TID: " << ls.tid << "]" << site_.context() << "[";
+        ls.append(time_, sizeof(time_));
+        ls << "] ";
+        break;
+    case Logger::LOGFMT:
+        ls << "time=\"";
+        ls.append(time_, sizeof(time_));
+        ls << "\" level=" << Logger::level_str[ls.level] << " tid=" << ls.tid
+           << site_.context(format) << " msg=\"";
+        break;
+    case Logger::JSON:
+        ls << "{\"time\":\"";
+        ls.append(time_, sizeof(time_));
+        ls << "\",\"level\":\"" << Logger::level_str[ls.level]
+           << "\",\"tid\":" << ls.tid << site_.context(format)
+           << ",\"msg\":\"";
+        break;
+    }
+    ls.begin_message(format);
     return ls;
 }
 
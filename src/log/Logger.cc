@@ -1,10 +1,19 @@
 #include "log/Logger.h"
+#include "log/BinaryLog.h"
 #include "util/CountDownLatch.h"
+#include "util/SpscRing.h"
 #include "util/TimeUtil.h"
 #include "log/LogFile.h"
+#include "log/SinkWriter.h"
 
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <stdexcept>
+#include <system_error>
+
+#include <string.h>
 
 namespace nijika {
 
@@ -19,113 +28,1146 @@ const char *Logger::level_str[6] = {"DEBUG", "INFO",  "TRACE",
 
 std::chrono::seconds Logger::DEFAULT_FLUSH_INTERVAL(3);
 
+std::chrono::milliseconds Logger::DEFAULT_BLOCK_TIMEOUT(100);
+
+std::atomic<int> Logger::threshold_(Logger::DEBUG);
+
+struct Logger::ThreadRing {
+    ThreadRing(size_t size, size_t seq)
+        : ring(size), seq(seq), closed(false), signalled(false) {}
+
+    SpscRing ring;
+    size_t seq;               // Registration order, picks the shard.
+    std::atomic<bool> closed; // Owner thread has exited.
+    bool signalled;           // Writer already notified. (producer only)
+};
+
+struct Logger::Barrier {
+    std::atomic<size_t> remaining; // Writers yet to pass it.
+    std::atomic<int> error{0};     // Of a failed commit of any writer.
+    std::promise<void> promise;    // Set by the last one.
+
+    /**
+     * Called once by each writer passing the barrier.
+     * @param err: errno of the failed commit of the writer, or 0.
+     */
+    void pass(int err = 0) {
+        if (err != 0) {
+            error.store(err, std::memory_order_relaxed);
+        }
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            err = error.load(std::memory_order_relaxed);
+            if (err == 0) {
+                promise.set_value();
+            } else {
+                promise.set_exception(std::make_exception_ptr(
+                    std::system_error(err, std::generic_category(),
+                                      "Syncing the log file failed")));
+            }
+        }
+    }
+};
+
+/**
+ * Tickets of one writer. Producers take a ticket after queueing their data,
+ * the writer reads the tickets before taking the data, so the data of every
+ * ticket it read is in the cycle.
+ */
+struct Logger::GroupCommit {
+    // Barrier of flush_async waiting on the writer.
+    struct Waiter {
+        bool durable;                     // Waits for the disk.
+        uint64_t ticket;                  // Ticket of its lane.
+        std::shared_ptr<Barrier> barrier; // Passed when the ticket is done.
+    };
+
+    std::atomic<uint64_t> requested{0}; // Durable lines and barriers.
+    std::atomic<uint64_t> written{0};   // Barriers only waiting for write.
+    uint64_t read_requested = 0;        // Read by the writer. (writer only)
+    uint64_t read_written = 0;          // Read by the writer. (writer only)
+    uint64_t done = 0;                  // Tickets durable, under mut.
+    uint64_t flushed = 0;               // Tickets written, under mut.
+    // Tickets in [failed_from, failed_to) were not made durable, under mut.
+    // A failure joins the previous one, including the tickets between, so
+    // a producer woken late never sees a later cycle's success instead.
+    uint64_t failed_from = 0;
+    uint64_t failed_to = 0;
+    int error = 0; // Of the last failed commit, under mut.
+    std::mutex mut;
+    std::condition_variable cv;  // For blocking durable lines.
+    std::vector<Waiter> waiters; // Under mut.
+
+    /**
+     * @return: true if a ticket waits. (writer side)
+     */
+    bool pending() const noexcept {
+        return requested.load(std::memory_order_acquire) != done ||
+               written.load(std::memory_order_acquire) != flushed;
+    }
+
+    /**
+     * @return: 0, or the errno of the commit that failed the ticket.
+     * (under mut)
+     */
+    int failed(uint64_t ticket) const noexcept {
+        return ticket >= failed_from && ticket < failed_to ? error : 0;
+    }
+
+    /**
+     * Reads the tickets handed out, before taking the data. (writer side)
+     */
+    void read() noexcept {
+        read_requested = requested.load(std::memory_order_acquire);
+        read_written = written.load(std::memory_order_acquire);
+    }
+};
+
+struct Logger::RingShard {
+    std::unique_ptr<LogFile> file;    // Own log file, null for shard 0.
+    LogFile *output;                  // Log file written by the shard.
+    std::thread writer;               // Writing thread.
+    std::mutex mut;                   // Guards pending and blocked.
+    std::condition_variable cv;       // For blocking the writer.
+    std::condition_variable space_cv; // For producers on a full ring.
+    bool pending = false;             // A ring needs draining.
+    size_t blocked = 0;               // Producers waiting on space_cv.
+    std::atomic<bool> idle{false};    // Writer sleeps until a first line.
+    GroupCommit commit;               // Tickets of the shard.
+};
+
+struct Logger::RingHandle {
+    std::shared_ptr<ThreadRing> ring;
+
+    ~RingHandle() {
+        if (ring) {
+            ring->closed = true;
+        }
+    }
+};
+
+struct Logger::ThreadStats {
+    std::atomic<uint64_t> lines{0}; // Written by the owner thread only.
+    std::atomic<uint64_t> bytes{0}; // Written by the owner thread only.
+};
+
+struct Logger::StatsHandle {
+    std::shared_ptr<ThreadStats> stats;
+
+    ~StatsHandle() {
+        if (stats) {
+            Logger::get_instance().retire_stats(stats);
+        }
+    }
+};
+
 Logger &Logger::get_instance() {
     static Logger self;
     return self;
 }
 
 void Logger::init(const std::string &path, off_t roll_size, size_t buffer_size,
-                  std::chrono::seconds flush_interval) {
+                  std::chrono::microseconds flush_interval,
+                  const FileOptions &options) {
     if (output_) {
         // An effective log file indicates the initialization is done.
         return;
     }
 
-    output_ = std::make_unique<LogFile>(path, roll_size, buffer_size * 3);
+    output_ = std::make_unique<LogFile>(
+        path, roll_size, buffer_size * 3, options,
+        options.binary ? &BinaryLog::file_header : nullptr);
+    binary_ = options.binary;
+    path_ = path;
+    roll_size_ = roll_size;
+    options_ = options;
     buffer_size_ = buffer_size;
-    flush_interval_ = flush_interval;
+    max_latency_.store(flush_interval.count(), std::memory_order_relaxed);
+
+    if (!options.persist_path.empty()) {
+        // Recovered lines must reach the log file before the ring is reset.
+        recover_persisted();
+        std::string sites = options.persist_path + ".sites";
+        if (binary_) {
+            BinaryLog::keep_sites(sites);
+        } else {
+            unlink(sites.c_str()); // Left by a binary process.
+        }
+        persist_ = std::make_unique<PersistentRing>(options.persist_path,
+                                                    options.persist_size);
+    }
 }
 
-Logger::Logger() : run_(false), buffer_size_(DEFUALT_BUFFER_SIZE) {}
+Logger::Logger()
+    : binary_(false), run_(false),
+      max_latency_(std::chrono::microseconds(DEFAULT_FLUSH_INTERVAL).count()),
+      max_batch_(0), buffer_size_(DEFUALT_BUFFER_SIZE), batch_bytes_(0),
+      writer_idle_(false), writer_pending_(false), queued_durable_(0),
+      wakeups_(0), policy_(BLOCK), max_queue_size_(DEFAULT_MAX_QUEUE_SIZE),
+      block_timeout_(DEFAULT_BLOCK_TIMEOUT.count()), blocked_(0),
+      timed_out_(0), dropped_lines_(0), dropped_buffers_(0), dropped_bytes_(0),
+      reported_lines_(0), reported_buffers_(0),
+      time_zone_(TimestampFormatter::LOCAL), time_offset_(0), format_(TEXT),
+      durable_level_(FATAL + 1), commit_(std::make_unique<GroupCommit>()),
+      commits_(0), durable_lines_(0), failed_commits_(0),
+      failed_durable_lines_(0), mode_(SHARED_BUFFER),
+      ring_size_(DEFAULT_RING_SIZE), ring_seq_(0), retired_lines_(0),
+      retired_bytes_(0), written_bytes_(0), buffer_allocations_(0),
+      flushes_(0), sink_count_(0), sink_threshold_(FATAL + 1) {
+    for (auto &&bucket : flush_latency_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    for (auto &&bucket : commit_latency_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
 
 Logger::~Logger() { async_stop(); }
 
-// size_t write_submit = 0;
-void Logger::write(const std::string &line) {
+void Logger::set_overflow_policy(overflow_policy policy,
+                                 size_t max_queue_size,
+                                 std::chrono::milliseconds block_timeout) {
+    max_queue_size_.store(max_queue_size, std::memory_order_relaxed);
+    block_timeout_.store(block_timeout.count(), std::memory_order_relaxed);
+    policy_.store(policy, std::memory_order_relaxed);
+}
+
+void Logger::set_flush_policy(std::chrono::microseconds max_latency,
+                              size_t max_batch) {
+    max_latency_.store(std::max<long>(max_latency.count(), 1),
+                       std::memory_order_relaxed);
+    max_batch_.store(max_batch, std::memory_order_relaxed);
+}
+
+Logger::OverflowStats Logger::overflow_stats() const {
+    OverflowStats stats;
+    stats.blocked = blocked_.load(std::memory_order_relaxed);
+    stats.timed_out = timed_out_.load(std::memory_order_relaxed);
+    stats.dropped_lines = dropped_lines_.load(std::memory_order_relaxed);
+    stats.dropped_buffers = dropped_buffers_.load(std::memory_order_relaxed);
+    stats.dropped_bytes = dropped_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+Logger::CompressionStats Logger::compression_stats() const {
+    if (!output_) {
+        return CompressionStats();
+    }
+    return output_->compression_stats();
+}
+
+size_t Logger::add_sink(std::shared_ptr<LogSink> sink, level threshold,
+                        size_t buffer_size, size_t max_queue_size) {
+    std::lock_guard<std::mutex> lock(sinks_mut_);
+
+    size_t id = sink_count_.load(std::memory_order_relaxed);
+    if (id == MAX_SINKS) {
+        throw std::logic_error("Too many log sinks.");
+    }
+
+    sinks_[id] = std::make_unique<SinkWriter>(
+        std::move(sink), threshold, buffer_size, max_queue_size,
+        std::chrono::ceil<std::chrono::milliseconds>(
+            std::chrono::microseconds(
+                max_latency_.load(std::memory_order_relaxed))));
+
+    if (threshold < sink_threshold_.load(std::memory_order_relaxed)) {
+        sink_threshold_.store(threshold, std::memory_order_relaxed);
+    }
+    // Publishes the new sink to producers.
+    sink_count_.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+Logger::Stats Logger::stats() const {
+    Stats stats = Stats();
+
+    {
+        std::lock_guard<std::mutex> lock(stats_mut_);
+        stats.submitted_lines = retired_lines_;
+        stats.submitted_bytes = retired_bytes_;
+        for (auto &&ts : thread_stats_) {
+            stats.submitted_lines += ts->lines.load(std::memory_order_relaxed);
+            stats.submitted_bytes += ts->bytes.load(std::memory_order_relaxed);
+        }
+    }
+
+    stats.written_bytes = written_bytes_.load(std::memory_order_relaxed);
+    stats.buffer_allocations =
+        buffer_allocations_.load(std::memory_order_relaxed);
+    stats.flushes = flushes_.load(std::memory_order_relaxed);
+    stats.wakeups = wakeups_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < FLUSH_BUCKETS; ++i) {
+        stats.flush_latency[i] =
+            flush_latency_[i].load(std::memory_order_relaxed);
+    }
+    stats.commits = commits_.load(std::memory_order_relaxed);
+    stats.durable_lines = durable_lines_.load(std::memory_order_relaxed);
+    stats.failed_commits = failed_commits_.load(std::memory_order_relaxed);
+    stats.failed_durable_lines =
+        failed_durable_lines_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < FLUSH_BUCKETS; ++i) {
+        stats.commit_latency[i] =
+            commit_latency_[i].load(std::memory_order_relaxed);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        stats.queued_buffers = buffers_.size();
+        stats.pooled_buffers = pool_ ? pool_->available() : 0;
+        stats.queued_bytes = curr_buf_.bytes();
+        for (auto &&buf : buffers_) {
+            stats.queued_bytes += buf.bytes();
+        }
+        if (persist_) {
+            stats.queued_bytes += persist_->size();
+        }
+    }
+
+    std::vector<LogFile *> files;
+    if (output_) {
+        files.push_back(output_.get());
+    }
+    {
+        std::lock_guard<std::mutex> lock(rings_mut_);
+        for (auto &&tr : rings_) {
+            stats.queued_bytes += tr->ring.backlog();
+        }
+        for (auto &&shard : shards_) {
+            if (shard->file) {
+                files.push_back(shard->file.get());
+            }
+        }
+    }
+    for (auto &&file : files) {
+        LogFile::Stats fs = file->stats();
+        stats.file_bytes += fs.bytes;
+        stats.rotations += fs.rotations;
+        stats.writes += fs.writes;
+        stats.write_nanos += fs.write_nanos;
+    }
+
+    stats.overflow = overflow_stats();
+    stats.compression = compression_stats();
+    return stats;
+}
+
+Logger::ThreadStats &Logger::local_stats() {
+    thread_local StatsHandle handle;
+
+    if (!handle.stats) {
+        handle.stats = std::make_shared<ThreadStats>();
+        std::lock_guard<std::mutex> lock(stats_mut_);
+        thread_stats_.push_back(handle.stats);
+    }
+
+    return *handle.stats;
+}
+
+void Logger::retire_stats(const std::shared_ptr<ThreadStats> &stats) {
+    std::lock_guard<std::mutex> lock(stats_mut_);
+    retired_lines_ += stats->lines.load(std::memory_order_relaxed);
+    retired_bytes_ += stats->bytes.load(std::memory_order_relaxed);
+    thread_stats_.erase(
+        std::remove(thread_stats_.begin(), thread_stats_.end(), stats),
+        thread_stats_.end());
+}
+
+/**
+ * @return: the latency histogram bucket of the time since begin.
+ */
+static size_t latency_bucket(std::chrono::steady_clock::time_point begin) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+
+    size_t bucket = 0;
+    while (bucket + 1 < Logger::FLUSH_BUCKETS && us >= (1LL << bucket)) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+void Logger::count_flush(std::chrono::steady_clock::time_point begin) {
+    flush_latency_[latency_bucket(begin)].fetch_add(1,
+                                                     std::memory_order_relaxed);
+    flushes_.fetch_add(1, std::memory_order_relaxed);
+}
+
+Logger::SinkStats Logger::sink_stats(size_t id) const {
+    if (id >= sink_count_.load(std::memory_order_acquire)) {
+        return SinkStats();
+    }
+    return sinks_[id]->stats();
+}
+
+void Logger::set_time_zone(TimestampFormatter::zone zone,
+                           std::chrono::seconds offset) {
+    time_offset_.store(offset.count(), std::memory_order_relaxed);
+    time_zone_.store(zone, std::memory_order_relaxed);
+}
+
+void Logger::format_timestamp(char *out,
+                              std::chrono::system_clock::time_point tp) {
+    thread_local TimestampFormatter formatter;
+
+    formatter.format(
+        out, tp,
+        (TimestampFormatter::zone)time_zone_.load(std::memory_order_relaxed),
+        time_offset_.load(std::memory_order_relaxed));
+}
+
+void Logger::write(const char *line, size_t len, level lvl, bool durable) {
     if (!output_) {
         throw std::logic_error("Log file is not open.");
     }
 
-    // write_submit += line.size();
-    if (run_) {
-        async_write(line);
+    durable = durable || lvl >= durable_level_.load(std::memory_order_relaxed);
+    if (binary_) {
+        char rec[BinaryLog::MAX_RECORD_SIZE];
+        submit(rec, BinaryLog::text_record(rec, line, len), lvl, durable);
     } else {
-        sync_write(line);
+        submit(line, len, lvl, durable);
     }
 }
 
-void Logger::sync_write(const std::string &line) {
+void Logger::submit(const char *data, size_t len, level lvl, bool durable) {
+    // Only this thread writes them, no atomic read-modify-write needed.
+    ThreadStats &ts = local_stats();
+    ts.lines.store(ts.lines.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    ts.bytes.store(ts.bytes.load(std::memory_order_relaxed) + len,
+                   std::memory_order_relaxed);
+
+    if (lvl >= sink_threshold_.load(std::memory_order_relaxed)) {
+        write_sinks(data, len, lvl);
+    }
+
+    auto begin = durable ? std::chrono::steady_clock::now()
+                         : std::chrono::steady_clock::time_point();
+
+    int err = 0;
+    if (!run_) {
+        err = sync_write(data, len, durable);
+    } else {
+        bool queued;
+        if (mode_ == THREAD_RING) {
+            queued = ring_write(data, len, lvl, durable);
+        } else if (mode_ == PERSISTENT_RING) {
+            queued = persist_write(data, len, lvl, durable);
+        } else {
+            queued = async_write(data, len, lvl, durable);
+        }
+        if (!queued) {
+            // Dropped, and counted as such, by the overflow policy:
+            // DROP_NEWEST, DROP_OLDEST in ring modes, KEEP_SEVERE below ERROR
+            // or a BLOCK timeout. Also when larger than the ring, or when
+            // async-mode stopped while the line waited for space.
+            if (durable) {
+                failed_durable_lines_.fetch_add(1, std::memory_order_relaxed);
+            }
+            return;
+        }
+        if (durable) {
+            err = wait_durable();
+        }
+    }
+
+    if (durable && err != 0) {
+        // Reported by the writer, not known to be on disk.
+        failed_durable_lines_.fetch_add(1, std::memory_order_relaxed);
+    } else if (durable) {
+        commit_latency_[latency_bucket(begin)].fetch_add(
+            1, std::memory_order_relaxed);
+        durable_lines_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Logger::write_sinks(const char *data, size_t len, level lvl) {
+    size_t count = sink_count_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (sinks_[i]->accepts(lvl)) {
+            sinks_[i]->write(data, len);
+        }
+    }
+}
+
+int Logger::sync_write(const char *line, size_t len, bool durable) {
     std::lock_guard<std::mutex> lock(mut_);
-    output_->append(line);
+    output_->append(line, len);
+    written_bytes_.fetch_add(len, std::memory_order_relaxed);
+    return durable ? commit(*output_) : 0;
 }
 
-void Logger::async_run() {
+void Logger::async_run(async_mode mode, size_t ring_size, unsigned shards) {
     if (run_) {
         return;
     }
+    if (mode == PERSISTENT_RING && !persist_) {
+        throw std::logic_error("No file backs the persistent ring.");
+    }
 
-    run_ = true;
+    mode_ = mode;
+    ring_size_ = ring_size;
+    batch_bytes_ = 0;
+    queued_durable_ = 0;
+    writer_idle_ = false;
+    writer_pending_ = false;
 
-    // Pre-allocation.
-    curr_buf_ = FixedBuffer(buffer_size_);
-    next_buf_ = FixedBuffer(buffer_size_);
-    buffers_.reserve(32);
+    if (mode_ == SHARED_BUFFER) {
+        // Pre-allocation.
+        curr_buf_ = take_buffer();
+        next_buf_ = take_buffer();
+        buffers_.reserve(32);
+    }
+
+    if (mode_ == THREAD_RING) {
+        // Shard 0 writes the log file, the others open their own.
+        shards = std::max(shards, 1u);
+        std::vector<std::unique_ptr<RingShard>> created;
+        for (unsigned i = 0; i < shards; ++i) {
+            auto shard = std::make_unique<RingShard>();
+            if (i == 0) {
+                shard->output = output_.get();
+            } else {
+                shard->file = std::make_unique<LogFile>(
+                    path_, roll_size_, buffer_size_ * 3, options_,
+                    binary_ ? &BinaryLog::file_header : nullptr, i);
+                shard->output = shard->file.get();
+            }
+            created.push_back(std::move(shard));
+        }
+
+        std::lock_guard<std::mutex> lock(rings_mut_);
+        shards_.swap(created);
+    }
 
-    latch_ = std::make_unique<CountDownLatch>(1);
+    run_ = true;
 
-    writer_ = std::make_unique<std::thread>(&Logger::writer_func, this);
+    if (mode_ == THREAD_RING) {
+        latch_ = std::make_unique<CountDownLatch>(shards_.size());
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            shards_[i]->writer =
+                std::thread(&Logger::ring_writer_func, this, i);
+        }
+    } else if (mode_ == PERSISTENT_RING) {
+        latch_ = std::make_unique<CountDownLatch>(1);
+        writer_ =
+            std::make_unique<std::thread>(&Logger::persist_writer_func, this);
+    } else {
+        latch_ = std::make_unique<CountDownLatch>(1);
+        writer_ = std::make_unique<std::thread>(&Logger::writer_func, this);
+    }
 
-    // Wait for writer to initialize.
+    // Wait for writers to initialize.
     latch_->wait();
 }
 
+void Logger::set_buffer_pool(size_t count, bool huge_pages, bool locked) {
+    if (run_) {
+        throw std::logic_error("Buffer pool cannot change in async-mode.");
+    }
+    if (!output_) {
+        throw std::logic_error("Log file is not open.");
+    }
+
+    std::unique_ptr<BufferPool> pool;
+    if (count > 0) {
+        pool = std::make_unique<BufferPool>(buffer_size_, count, huge_pages,
+                                            locked);
+    }
+
+    std::lock_guard<std::mutex> lock(mut_);
+    // Buffers kept from a previous async-mode may belong to the old pool.
+    curr_buf_ = FixedBuffer();
+    next_buf_ = FixedBuffer();
+    pool_.swap(pool);
+}
+
 void Logger::async_stop() {
     if (!run_) {
         return;
     }
 
     run_ = false;
+
+    if (mode_ == THREAD_RING) {
+        for (auto &&shard : shards_) {
+            {
+                std::lock_guard<std::mutex> lock(shard->mut);
+                shard->cv.notify_one();
+                shard->space_cv.notify_all();
+            }
+            shard->writer.join();
+            release_durable(shard->commit);
+        }
+        return;
+    }
+
     {
         std::lock_guard<std::mutex> lock(mut_);
         cv_.notify_one();
+        space_cv_.notify_all();
     }
 
     writer_->join();
+    release_durable(*commit_);
 }
 
-// size_t async_write_submit = 0;
+int Logger::wait_durable() {
+    GroupCommit *gc;
+    uint64_t ticket;
+    if (mode_ == THREAD_RING) {
+        ThreadRing &tr = local_ring();
+        gc = &shards_[tr.seq % shards_.size()]->commit;
+        ticket = gc->requested.fetch_add(1, std::memory_order_acq_rel);
+        notify_writer(tr);
+    } else {
+        gc = commit_.get();
+        ticket = gc->requested.fetch_add(1, std::memory_order_acq_rel);
+        wake_writers();
+    }
 
-void Logger::async_write(const std::string &line) {
-    std::lock_guard<std::mutex> lock(mut_);
+    std::unique_lock<std::mutex> lock(gc->mut);
+    gc->cv.wait(lock, [&]() { return gc->done > ticket || !run_; });
+    return gc->failed(ticket);
+}
 
-    if (curr_buf_.avail() > line.size()) {
-        // Enough space in current buffer.
-        curr_buf_.append(line);
+std::future<void> Logger::flush_async(bool durable) {
+    if (!output_) {
+        throw std::logic_error("Log file is not open.");
+    }
+
+    auto barrier = std::make_shared<Barrier>();
+    std::future<void> res = barrier->promise.get_future();
+
+    std::vector<GroupCommit *> gcs;
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        if (!run_) {
+            // Sync-mode, the data is in the file buffer.
+            output_->wait_writes();
+            barrier->remaining.store(1, std::memory_order_relaxed);
+            barrier->pass(durable ? commit(*output_) : 0);
+            return res;
+        }
+
+        if (mode_ == THREAD_RING) {
+            for (auto &&shard : shards_) {
+                gcs.push_back(&shard->commit);
+            }
+        } else {
+            gcs.push_back(commit_.get());
+        }
+    }
+
+    barrier->remaining.store(gcs.size(), std::memory_order_relaxed);
+    for (auto &&gc : gcs) {
+        // Registered along with the ticket, so the writer completing the
+        // ticket always finds the waiter.
+        std::lock_guard<std::mutex> lock(gc->mut);
+        auto &lane = durable ? gc->requested : gc->written;
+        uint64_t ticket = lane.fetch_add(1, std::memory_order_acq_rel);
+        gc->waiters.push_back({durable, ticket, barrier});
+    }
+    wake_writers();
+
+    if (!run_) {
+        // Stopped meanwhile, the writers may have released their waiters
+        // before ours were registered. Whoever removes a waiter passes it.
+        for (auto &&gc : gcs) {
+            bool found;
+            {
+                std::lock_guard<std::mutex> lock(gc->mut);
+                auto it = std::find_if(
+                    gc->waiters.begin(), gc->waiters.end(),
+                    [&](const GroupCommit::Waiter &w) {
+                        return w.barrier == barrier;
+                    });
+                found = it != gc->waiters.end();
+                if (found) {
+                    gc->waiters.erase(it);
+                }
+            }
+            if (found) {
+                barrier->pass();
+            }
+        }
+    }
+
+    return res;
+}
+
+void Logger::wake_writers() {
+    if (mode_ == THREAD_RING) {
+        for (auto &&shard : shards_) {
+            {
+                std::lock_guard<std::mutex> lock(shard->mut);
+                shard->pending = true;
+            }
+            shard->cv.notify_one();
+        }
+        return;
+    }
+
+    {
+        // Under the lock, so the writer cannot miss the wake-up.
+        std::lock_guard<std::mutex> lock(mut_);
+        writer_pending_ = true;
+    }
+    cv_.notify_one();
+}
+
+void Logger::group_commit(GroupCommit &gc, LogFile &output) {
+    bool sync = gc.read_requested != gc.done;
+    if (!sync && gc.read_written == gc.flushed) {
+        // No ticket in this cycle.
         return;
     }
 
+    int err = 0;
+    if (sync) {
+        err = commit(output);
+    } else {
+        // Written means reaped in IO_URING mode, not only submitted.
+        output.wait_writes();
+    }
+
+    std::vector<std::pair<std::shared_ptr<Barrier>, int>> passed;
+    {
+        std::lock_guard<std::mutex> lock(gc.mut);
+        if (err != 0) {
+            if (gc.failed_to == 0) {
+                gc.failed_from = gc.done;
+            }
+            gc.failed_to = gc.read_requested;
+            gc.error = err;
+        }
+        gc.done = gc.read_requested;
+        gc.flushed = gc.read_written;
+
+        auto done = [&](const GroupCommit::Waiter &w) {
+            if ((w.durable ? gc.done : gc.flushed) <= w.ticket) {
+                return false;
+            }
+            passed.emplace_back(w.barrier, w.durable ? gc.failed(w.ticket) : 0);
+            return true;
+        };
+        gc.waiters.erase(
+            std::remove_if(gc.waiters.begin(), gc.waiters.end(), done),
+            gc.waiters.end());
+    }
+    if (sync) {
+        gc.cv.notify_all();
+    }
+
+    for (auto &&barrier : passed) {
+        barrier.first->pass(barrier.second);
+    }
+}
+
+int Logger::commit(LogFile &output) {
+    int err = output.sync();
+    commits_.fetch_add(1, std::memory_order_relaxed);
+    if (err == 0) {
+        return 0;
+    }
+
+    // Not into the log file, which is what failed.
+    failed_commits_.fetch_add(1, std::memory_order_relaxed);
+    std::string msg = "Syncing the log file failed at ";
+    msg += to_formatted_string("%F %T", std::chrono::system_clock::now());
+    msg += ": ";
+    msg += std::generic_category().message(err);
+    msg += ".\n";
+    std::cerr << msg;
+
+    return err;
+}
+
+void Logger::release_durable(GroupCommit &gc) {
+    // The writer has exited, nothing is left to wait for.
+    std::vector<GroupCommit::Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> lock(gc.mut);
+        waiters.swap(gc.waiters);
+    }
+    gc.cv.notify_all();
+
+    for (auto &&w : waiters) {
+        w.barrier->pass();
+    }
+}
+
+Logger::ThreadRing &Logger::local_ring() {
+    thread_local RingHandle handle;
+
+    if (!handle.ring) {
+        std::lock_guard<std::mutex> lock(rings_mut_);
+        handle.ring = std::make_shared<ThreadRing>(ring_size_, ring_seq_++);
+        rings_.push_back(handle.ring);
+    }
+
+    return *handle.ring;
+}
+
+void Logger::notify_writer(const ThreadRing &tr) {
+    RingShard &shard = *shards_[tr.seq % shards_.size()];
+    {
+        std::lock_guard<std::mutex> lock(shard.mut);
+        shard.pending = true;
+    }
+    shard.cv.notify_one();
+}
+
+bool Logger::may_block(level lvl, bool durable) const {
+    if (durable) {
+        // Its producer waits for the disk anyway.
+        return true;
+    }
+
+    switch (policy_.load(std::memory_order_relaxed)) {
+    case BLOCK:
+        return true;
+    case KEEP_SEVERE:
+        return lvl >= ERROR;
+    default:
+        return false;
+    }
+}
+
+void Logger::drop_line(size_t len) {
+    dropped_lines_.fetch_add(1, std::memory_order_relaxed);
+    dropped_bytes_.fetch_add(len, std::memory_order_relaxed);
+}
+
+bool Logger::ring_write(const char *line, size_t len, level lvl,
+                        bool durable) {
+    ThreadRing &tr = local_ring();
+    SpscRing &ring = tr.ring;
+
+    if (len > ring.capacity()) {
+        // Larger than the whole ring, it can never fit.
+        drop_line(len);
+        return false;
+    }
+
+    if (!ring.push(line, len)) {
+        // Ring is full.
+        if (!may_block(lvl, durable)) {
+            drop_line(len);
+            return false;
+        }
+
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        auto timeout = std::chrono::milliseconds(
+            block_timeout_.load(std::memory_order_relaxed));
+        bool pushed = false;
+        auto pushed_or_stopped = [&]() {
+            pushed = run_ && ring.push(line, len);
+            return pushed || !run_;
+        };
+
+        // Wake up the writer once, it wakes us up after draining.
+        RingShard &shard = *shards_[tr.seq % shards_.size()];
+        std::unique_lock<std::mutex> lock(shard.mut);
+        tr.signalled = true;
+        shard.pending = true;
+        shard.cv.notify_one();
+        ++shard.blocked;
+        if (durable) {
+            shard.space_cv.wait(lock, pushed_or_stopped);
+        } else {
+            shard.space_cv.wait_for(lock, timeout, pushed_or_stopped);
+        }
+        --shard.blocked;
+
+        if (!pushed) {
+            timed_out_.fetch_add(1, std::memory_order_relaxed);
+            drop_line(len);
+            return false;
+        }
+    }
+
+    // Wake up the writer once per crossing of the batch size, and on the
+    // first line after it went idle, so the fast path only reads a flag the
+    // writer rarely writes.
+    size_t half = ring.capacity() / 2;
+    size_t batch = max_batch_.load(std::memory_order_relaxed);
+    if (ring.backlog() >= (batch ? std::min(batch, half) : half)) {
+        if (!tr.signalled) {
+            tr.signalled = true;
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            notify_writer(tr);
+        }
+        return true;
+    }
+    tr.signalled = false;
+
+    RingShard &shard = *shards_[tr.seq % shards_.size()];
+    if (shard.idle.load(std::memory_order_relaxed) &&
+        shard.idle.exchange(false)) {
+        wakeups_.fetch_add(1, std::memory_order_relaxed);
+        {
+            // Under the lock, so the writer cannot miss the wake-up.
+            std::lock_guard<std::mutex> lock(shard.mut);
+        }
+        shard.cv.notify_one();
+    }
+    return true;
+}
+
+bool Logger::async_write(const char *line, size_t len, level lvl,
+                         bool durable) {
+    std::unique_lock<std::mutex> lock(mut_);
+
+    if (curr_buf_.avail() > len) {
+        // Enough space in current buffer.
+        curr_buf_.append(line, len);
+        add_to_batch(len, durable);
+        return true;
+    }
+
+    // The current buffer is about to join the queue, enforce the cap.
+    size_t max_buffers = std::max(
+        max_queue_size_.load(std::memory_order_relaxed) / buffer_size_,
+        (size_t)1);
+
+    if (buffers_.size() >= max_buffers) {
+        // Never drop the lines of producers waiting for the disk.
+        if (policy_.load(std::memory_order_relaxed) == DROP_OLDEST &&
+            queued_durable_ == 0) {
+            FixedBuffer &oldest = buffers_.front();
+            dropped_buffers_.fetch_add(1, std::memory_order_relaxed);
+            dropped_bytes_.fetch_add(oldest.bytes(), std::memory_order_relaxed);
+            if (!next_buf_) {
+                // Recycle it as the backup buffer.
+                oldest.clear();
+                next_buf_ = std::move(oldest);
+            }
+            buffers_.erase(buffers_.begin());
+        } else if (!may_block(lvl, durable)) {
+            drop_line(len);
+            return false;
+        } else {
+            blocked_.fetch_add(1, std::memory_order_relaxed);
+            auto timeout = std::chrono::milliseconds(
+                block_timeout_.load(std::memory_order_relaxed));
+            auto has_space = [&]() {
+                return !run_ || buffers_.size() < max_buffers ||
+                       curr_buf_.avail() > len;
+            };
+
+            writer_pending_ = true;
+            cv_.notify_one();
+            bool ok = true;
+            if (durable) {
+                space_cv_.wait(lock, has_space);
+            } else {
+                ok = space_cv_.wait_for(lock, timeout, has_space);
+            }
+
+            if (!ok || !run_) {
+                timed_out_.fetch_add(1, std::memory_order_relaxed);
+                drop_line(len);
+                return false;
+            }
+
+            if (curr_buf_.avail() > len) {
+                // The writer has swapped in an empty buffer.
+                curr_buf_.append(line, len);
+                add_to_batch(len, durable);
+                return true;
+            }
+        }
+    }
+
     buffers_.emplace_back(std::move(curr_buf_));
 
     if (next_buf_) {
         // Replace current buffer.
         curr_buf_ = std::move(next_buf_);
+    } else if (pool_ && (curr_buf_ = pool_->acquire())) {
+        // Taken from the pool, refilled by the writer.
     } else {
         // Allocate new buffer(rarely happens).
         curr_buf_ = FixedBuffer(buffer_size_);
+        buffer_allocations_.fetch_add(1, std::memory_order_relaxed);
     }
 
-    curr_buf_.append(line);
+    curr_buf_.append(line, len);
+    add_to_batch(len, durable);
+    return true;
+}
+
+bool Logger::persist_write(const char *line, size_t len, level lvl,
+                           bool durable) {
+    std::unique_lock<std::mutex> lock(mut_);
 
-    // Notify writer.
-    cv_.notify_one();
+    if (len > persist_->capacity()) {
+        // Larger than the whole ring, it can never fit.
+        drop_line(len);
+        return false;
+    }
+
+    if (!persist_->push(line, len)) {
+        // Ring is full.
+        if (!may_block(lvl, durable)) {
+            drop_line(len);
+            return false;
+        }
+
+        blocked_.fetch_add(1, std::memory_order_relaxed);
+        auto timeout = std::chrono::milliseconds(
+            block_timeout_.load(std::memory_order_relaxed));
+        auto has_space = [&]() { return !run_ || persist_->avail() >= len; };
+
+        writer_pending_ = true;
+        cv_.notify_one();
+        bool ok = true;
+        if (durable) {
+            space_cv_.wait(lock, has_space);
+        } else {
+            ok = space_cv_.wait_for(lock, timeout, has_space);
+        }
+
+        if (!ok || !run_) {
+            timed_out_.fetch_add(1, std::memory_order_relaxed);
+            drop_line(len);
+            return false;
+        }
+
+        persist_->push(line, len);
+    }
+
+    add_to_batch(len, durable);
+    return true;
+}
+
+void Logger::add_to_batch(size_t len, bool durable) {
+    queued_durable_ += durable;
+    size_t before = batch_bytes_;
+    batch_bytes_ += len;
+
+    if (before == 0) {
+        // First line of the batch, its wait starts now.
+        batch_begin_ = std::chrono::steady_clock::now();
+        if (writer_idle_) {
+            writer_idle_ = false;
+            wakeups_.fetch_add(1, std::memory_order_relaxed);
+            cv_.notify_one();
+        }
+        return;
+    }
+
+    size_t limit = batch_limit();
+    if (before < limit && batch_bytes_ >= limit && !writer_pending_) {
+        writer_pending_ = true;
+        wakeups_.fetch_add(1, std::memory_order_relaxed);
+        cv_.notify_one();
+    }
+}
+
+size_t Logger::batch_limit() const {
+    // Never more than the queue holds, a blocked producer waits for it.
+    size_t cap = mode_ == PERSISTENT_RING
+                     ? persist_->capacity() / 2
+                     : max_queue_size_.load(std::memory_order_relaxed);
+    size_t batch = max_batch_.load(std::memory_order_relaxed);
+    return std::min(batch ? batch : buffer_size_, cap);
+}
+
+void Logger::recover_persisted() {
+    std::string lost = PersistentRing::recover(options_.persist_path);
+    if (lost.empty()) {
+        return;
+    }
+
+    // Binary records come with the site definitions the crashed process
+    // kept, see BinaryLog::keep_sites.
+    std::ifstream in(options_.persist_path + ".sites", std::ios::binary);
+    std::string sites((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+
+    auto now = std::chrono::system_clock::now();
+    std::string msg = "Recovered log messages of a crashed process at ";
+    msg += to_formatted_string("%F %T", now);
+    msg += ", ";
+    msg += std::to_string(lost.size());
+    msg += " bytes";
+
+    std::string name;
+    if (!sites.empty()) {
+        // The site ids of the records belong to the crashed process, this
+        // one reuses them, so they go to a binary log file of their own.
+        name = path_ + "nijika-" + std::to_string(get_pid()) + "-" +
+               to_formatted_string("%Y%m%d-%H%M%S", now) + "-recovered.blog";
+        std::ofstream out(name, std::ios::binary | std::ios::trunc);
+        out.write(sites.data(), sites.size());
+        out.write(lost.data(), lost.size());
+        out.close();
+        msg += out ? ", written to " : ", lost, cannot write ";
+        msg += name;
+    }
+    msg += ".\n";
+    std::cerr << msg;
+
+    if (binary_) {
+        char rec[BinaryLog::MAX_RECORD_SIZE];
+        output_->append(rec,
+                        BinaryLog::text_record(rec, msg.data(), msg.size()));
+    } else {
+        output_->append(msg);
+    }
+
+    if (!name.empty()) {
+        output_->flush();
+        return;
+    }
+
+    for (size_t off = 0; off < lost.size(); off += buffer_size_) {
+        // Never exceeds the file buffer.
+        size_t n = std::min(lost.size() - off, buffer_size_);
+        output_->append(lost.data() + off, n);
+        written_bytes_.fetch_add(n, std::memory_order_relaxed);
+    }
+    output_->flush();
+}
+
+void Logger::wait_batch(std::unique_lock<std::mutex> &lock) {
+    if (batch_bytes_ == 0 && !writer_pending_) {
+        // Nothing queued, sleep until a first line.
+        writer_idle_ = true;
+        cv_.wait_for(lock, DEFAULT_FLUSH_INTERVAL, [&]() {
+            return batch_bytes_ > 0 || writer_pending_ || !run_;
+        });
+        writer_idle_ = false;
+    }
+
+    // Let the batch grow, at most until its first line is due.
+    auto deadline = batch_begin_ + std::chrono::microseconds(max_latency_.load(
+                                       std::memory_order_relaxed));
+    cv_.wait_until(lock, deadline, [&]() {
+        return batch_bytes_ >= batch_limit() || writer_pending_ || !run_;
+    });
+    writer_pending_ = false;
+}
+
+FixedBuffer Logger::take_buffer() {
+    if (pool_) {
+        FixedBuffer buf = pool_->acquire();
+        if (buf) {
+            return buf;
+        }
+    }
+    return FixedBuffer(buffer_size_);
 }
 
 void Logger::writer_func() {
 
     // Pre-allocation.
-    FixedBuffer buf1 = FixedBuffer(buffer_size_); // Backup current buffer.
-    FixedBuffer buf2 = FixedBuffer(buffer_size_); // Backup next buffer.
-    std::vector<FixedBuffer> buffers_to_write;     // Backup buffer queue.
+    FixedBuffer buf1 = take_buffer();          // Backup current buffer.
+    FixedBuffer buf2 = take_buffer();          // Backup next buffer.
+    std::vector<FixedBuffer> buffers_to_write; // Backup buffer queue.
     buffers_to_write.reserve(32);
 
     // Writer has successfully initialized.
@@ -135,39 +1177,35 @@ void Logger::writer_func() {
         {
             // Use move and swap to shorten the critical section.
             std::unique_lock<std::mutex> lock(mut_);
-            if (buffers_.empty()) {
-                cv_.wait_for(lock, flush_interval_);
-            }
+            wait_batch(lock);
 
+            // Read before taking the buffers, which hold the lines of the
+            // tickets then.
+            commit_->read();
             buffers_.emplace_back(std::move(curr_buf_));
             curr_buf_ = std::move(buf1);
             if (!next_buf_) {
                 next_buf_ = std::move(buf2);
             }
             buffers_to_write.swap(buffers_);
+            batch_bytes_ = 0;
+            queued_durable_ = 0;
         }
 
-        if (buffers_to_write.size() > 25) {
-            // To many buffers in the buffer queue.
-            std::string msg = "Dropped log messages at ";
-            msg +=
-                to_formatted_string("%F %T", std::chrono::system_clock::now());
-            msg += ", ";
-            msg += std::to_string(buffers_to_write.size() - 2);
-            msg += " larger buffers.\n";
-            std::cerr << msg;
+        // Wake up producers blocked by the overflow policy.
+        space_cv_.notify_all();
 
-            output_->append(msg);
-            buffers_to_write.erase(buffers_to_write.begin() + 2,
-                                   buffers_to_write.end());
-        }
+        auto begin = std::chrono::steady_clock::now();
+        report_drops();
 
         for (auto &&buffer : buffers_to_write) {
             // Writing to log file.
             output_->append(buffer);
-            // async_write_submit += buffer.bytes();
+            written_bytes_.fetch_add(buffer.bytes(),
+                                     std::memory_order_relaxed);
         }
 
+        // The rest go back to the pool, if they came from it.
         if (buffers_to_write.size() > 2) {
             buffers_to_write.resize(2);
         }
@@ -188,19 +1226,266 @@ void Logger::writer_func() {
         // Clear the buffer queue.
         buffers_to_write.clear();
         output_->flush();
+        count_flush(begin);
+        group_commit(*commit_, *output_);
     } // end while
 
     // Flush rest data in current buffer and buffer queue.
     std::lock_guard<std::mutex> lock(mut_);
+    commit_->read();
     if (!curr_buf_.empty()) {
         buffers_.emplace_back(std::move(curr_buf_));
     }
     for (auto &&buf : buffers_) {
         output_->append(buf);
+        written_bytes_.fetch_add(buf.bytes(), std::memory_order_relaxed);
     }
     buffers_.clear();
 
     output_->flush();
+    group_commit(*commit_, *output_);
+}
+
+void Logger::ring_writer_func(size_t index) {
+    RingShard &shard = *shards_[index];
+
+    // Writer has successfully initialized.
+    latch_->count_down();
+
+    size_t drained = 0;
+    while (run_) {
+        {
+            std::unique_lock<std::mutex> lock(shard.mut);
+            auto woken = [&]() { return shard.pending || !run_; };
+
+            if (drained == 0 && shard.idle) {
+                // Still nothing after a nap, sleep until a first line.
+                shard.cv.wait_for(lock, DEFAULT_FLUSH_INTERVAL, [&]() {
+                    return !shard.idle || shard.pending || !run_;
+                });
+            } else if (drained == 0) {
+                // Producers check the flag after pushing, one more nap
+                // catches a line pushed as it is set.
+                shard.idle = true;
+            }
+
+            // Let the rings fill up, at most until the first line is due.
+            shard.cv.wait_for(lock,
+                              std::chrono::microseconds(max_latency_.load(
+                                  std::memory_order_relaxed)),
+                              woken);
+            shard.pending = false;
+        }
+
+        // Read before draining, the rings hold the lines of the tickets.
+        shard.commit.read();
+        auto begin = std::chrono::steady_clock::now();
+        drained = drain_rings(index);
+        if (drained > 0) {
+            shard.idle.store(false, std::memory_order_relaxed);
+
+            // Wake up producers blocked by the overflow policy.
+            std::lock_guard<std::mutex> lock(shard.mut);
+            if (shard.blocked > 0) {
+                shard.space_cv.notify_all();
+            }
+        }
+        if (index == 0) {
+            // Drop notices go to the log file.
+            report_drops();
+        }
+        shard.output->flush();
+        count_flush(begin);
+        group_commit(shard.commit, *shard.output);
+    }
+
+    // Flush rest data in the rings.
+    shard.commit.read();
+    drain_rings(index);
+    shard.output->flush();
+    group_commit(shard.commit, *shard.output);
+}
+
+void Logger::persist_writer_func() {
+
+    // Writer has successfully initialized.
+    latch_->count_down();
+
+    while (run_) {
+        {
+            std::unique_lock<std::mutex> lock(mut_);
+            wait_batch(lock);
+            batch_bytes_ = 0;
+            queued_durable_ = 0;
+        }
+
+        // Read before draining, the ring holds the lines of the tickets.
+        commit_->read();
+        auto begin = std::chrono::steady_clock::now();
+        report_drops();
+        drain_persisted();
+        count_flush(begin);
+        group_commit(*commit_, *output_);
+    }
+
+    // Flush rest data in the ring.
+    commit_->read();
+    drain_persisted();
+    group_commit(*commit_, *output_);
+}
+
+void Logger::drain_persisted() {
+    written_bytes_.fetch_add(drain_records(*persist_, *output_),
+                             std::memory_order_relaxed);
+    output_->flush();
+
+    {
+        // Lines are in the kernel now, a crash can no longer lose them.
+        // Committed under the lock, so no blocked producer misses the wake.
+        std::lock_guard<std::mutex> lock(mut_);
+        persist_->commit();
+    }
+    space_cv_.notify_all();
+}
+
+void Logger::report_drops() {
+    uint64_t lines = dropped_lines_.load(std::memory_order_relaxed);
+    uint64_t buffers = dropped_buffers_.load(std::memory_order_relaxed);
+    if (lines == reported_lines_ && buffers == reported_buffers_) {
+        return;
+    }
+
+    std::string msg = "Dropped log messages at ";
+    msg += to_formatted_string("%F %T", std::chrono::system_clock::now());
+    msg += ", ";
+    msg += std::to_string(lines - reported_lines_);
+    msg += " lines and ";
+    msg += std::to_string(buffers - reported_buffers_);
+    msg += " larger buffers.\n";
+    std::cerr << msg;
+
+    if (binary_) {
+        char rec[BinaryLog::MAX_RECORD_SIZE];
+        output_->append(rec,
+                        BinaryLog::text_record(rec, msg.data(), msg.size()));
+    } else {
+        output_->append(msg);
+    }
+
+    reported_lines_ = lines;
+    reported_buffers_ = buffers;
+}
+
+size_t Logger::drain_rings(size_t index) {
+    LogFile &output = *shards_[index]->output;
+    size_t shards = shards_.size();
+
+    std::vector<std::shared_ptr<ThreadRing>> rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mut_);
+        for (auto &&tr : rings_) {
+            if (tr->seq % shards == index) {
+                rings.push_back(tr);
+            }
+        }
+    }
+
+    size_t drained = 0;
+    bool has_closed = false;
+    for (auto &&tr : rings) {
+        // Check before draining, so a closed ring is known to be empty after.
+        bool closed = tr->closed;
+
+        size_t n = drain_records(tr->ring, output);
+        written_bytes_.fetch_add(n, std::memory_order_relaxed);
+        drained += n;
+
+        has_closed = has_closed || closed;
+    }
+
+    if (has_closed) {
+        // Unregister rings whose owner threads have exited.
+        std::lock_guard<std::mutex> lock(rings_mut_);
+        auto done = [&](const std::shared_ptr<ThreadRing> &tr) {
+            return tr->seq % shards == index && tr->closed && tr->ring.empty();
+        };
+        rings_.erase(std::remove_if(rings_.begin(), rings_.end(), done),
+                     rings_.end());
+    }
+    return drained;
+}
+
+template <typename Ring>
+size_t Logger::drain_records(Ring &ring, LogFile &output) {
+    // Producers push whole records, so the ring ends with one. Only the
+    // cut one is copied, a chunk at a time until it is whole.
+    static constexpr size_t CHUNK = BinaryLog::MAX_RECORD_SIZE;
+
+    std::string cut;
+    size_t drained = 0;
+    const char *data;
+    size_t n;
+    while ((n = ring.peek(&data)) > 0) {
+        if (!cut.empty()) {
+            size_t before = cut.size();
+            n = std::min(n, CHUNK);
+            cut.append(data, n);
+            size_t whole = whole_records(cut.data(), cut.size());
+            if (whole > 0) {
+                output.append(cut.data(), whole);
+                drained += whole;
+                n = whole - before;
+                cut.clear();
+            }
+            ring.consume(n);
+            continue;
+        }
+
+        // Never exceeds the file buffer.
+        size_t whole = whole_records(data, std::min(n, buffer_size_));
+        if (whole == 0 && n <= buffer_size_) {
+            // Cut by the end of the ring.
+            cut.assign(data, n);
+            ring.consume(n);
+            continue;
+        }
+        if (whole == 0) {
+            // A record larger than the file buffer, written in pieces.
+            whole = buffer_size_;
+        }
+        output.append(data, whole);
+        ring.consume(whole);
+        drained += whole;
+    }
+
+    if (!cut.empty()) {
+        // Not a whole record after all, keep the bytes.
+        output.append(cut);
+        drained += cut.size();
+    }
+    return drained;
+}
+
+size_t Logger::whole_records(const char *data, size_t len) const {
+    if (!binary_) {
+        const char *end = (const char *)memrchr(data, '\n', len);
+        return end ? end - data + 1 : 0;
+    }
+
+    size_t pos = 0;
+    BinaryLog::RecordHeader header;
+    while (len - pos >= sizeof(header)) {
+        memcpy(&header, data + pos, sizeof(header));
+        if (header.size < sizeof(header)) {
+            // Never pushed, do not loop on it.
+            return len;
+        }
+        if (header.size > len - pos) {
+            break;
+        }
+        pos += header.size;
+    }
+    return pos;
 }
 
 } // namespace log
@@ -1,11 +1,17 @@
 #pragma once
 
+#include "util/BufferPool.h"
 #include "util/CountDownLatch.h"
 #include "util/FixedBuffer.h"
 #include "util/Noncopyable.h"
+#include "util/PersistentRing.h"
+#include "util/TimeUtil.h"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <future>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -16,9 +22,70 @@ namespace nijika {
 namespace log {
 
 class LogFile;
+class LogSink;
+class BinaryLog;
+class SinkWriter;
 
 using namespace util;
 
+/**
+ * Options of the log file back-end.
+ */
+struct FileOptions {
+    /**
+     * WRITE: buffers data and write(2)s it on flush.
+     * MMAP: copies data straight into a shared mapping of the file, which
+     * grows in chunks of mmap_chunk_size. Files are truncated to their real
+     * length when closed. Each chunk is allocated with fallocate, so page
+     * faults never hit a full disk; falls back to WRITE on filesystems
+     * without fallocate.
+     * IO_URING: submits full buffers as io_uring writes and keeps filling
+     * another buffer meanwhile, recycling buffers on completion. Falls back
+     * to WRITE when io_uring is unavailable.
+     * DIRECT: writes page-aligned buffers with O_DIRECT, bypassing the page
+     * cache. The last partial page is padded and rewritten on the next flush.
+     */
+    enum output_mode { WRITE = 0, MMAP, IO_URING, DIRECT };
+
+    // Write the binary deferred-formatting format (see BinaryLog), decoded
+    // by nilog-decode. Text lines are stored as text records.
+    bool binary = false;
+
+    output_mode mode = WRITE;
+    size_t mmap_chunk_size = 1 << 24; // Aka 16MB, a multiple of page size.
+    bool mmap_sync = false; // msync(MS_SYNC) written data on every flush.
+    unsigned uring_depth = 4; // Max buffers in flight. (IO_URING mode)
+
+    // Every writeback_size bytes, start writeback of the new range with
+    // sync_file_range, wait for the previous range and drop it from the page
+    // cache, so dirty pages stay bounded. 0 disables. (Ignored in DIRECT mode)
+    size_t writeback_size = 0;
+
+    // Compress rotated files to name.lz4 on this many background threads,
+    // splitting each file into blocks compressed in parallel. 0 disables.
+    unsigned compress_threads = 0;
+    int compress_nice = 10; // Nice value of the compression threads.
+
+    // Compress every flushed buffer into an independent LZ4 frame on the
+    // writer thread, and end each file with a frame index (see SeekableLz4),
+    // so any part can be read without decompressing the whole file. Files
+    // get a .lz4 suffix and are written with write(2), mode and
+    // compress_threads are ignored.
+    bool inline_compress = false;
+
+    // File backing the queue of PERSISTENT_RING async-mode, so queued lines
+    // survive a crash of the process. init appends the lines a crashed
+    // process left in it to the log file, then reuses it. In binary mode the
+    // site definitions are kept in persist_path.sites, and the records are
+    // written with them to nijika-pid-date-time-recovered.blog instead, as
+    // the new process reuses their site ids. IO_URING writes still in
+    // flight at the crash are not covered. Empty disables.
+    std::string persist_path;
+    // Aka 16MB, capacity of the queue. A line larger than it is dropped,
+    // even a durable one, see Logger::Stats::failed_durable_lines.
+    size_t persist_size = 1 << 24;
+};
+
 /**
  * Log system back-end. Supports both synchronous and asynchronous mode.
  * @thread-safety: safe.
@@ -26,14 +93,123 @@ using namespace util;
 class Logger : Noncopyable {
 
   public:
-    static constexpr off_t DEFAULT_ROLL_SIZE = 1 << 26;    // Aka 64MB.
-    static constexpr size_t DEFUALT_BUFFER_SIZE = 1 << 23; // Aka 8MB.
+    static constexpr off_t DEFAULT_ROLL_SIZE = 1 << 26;       // Aka 64MB.
+    static constexpr size_t DEFUALT_BUFFER_SIZE = 1 << 23;    // Aka 8MB.
+    static constexpr size_t DEFAULT_RING_SIZE = 1 << 20;      // Aka 1MB.
+    static constexpr size_t DEFAULT_MAX_QUEUE_SIZE = 1 << 28; // Aka 256MB.
+    static constexpr size_t DEFAULT_SINK_BUFFER_SIZE = 1 << 20; // Aka 1MB.
+    static constexpr size_t DEFAULT_SINK_QUEUE_SIZE = 1 << 24;  // Aka 16MB.
+    static constexpr size_t MAX_SINKS = 8;
+    static constexpr size_t FLUSH_BUCKETS = 20; // Up to 2^19us, aka 0.5s.
     static const char *DEFAULT_PATH;
     static std::chrono::seconds DEFAULT_FLUSH_INTERVAL;
+    static std::chrono::milliseconds DEFAULT_BLOCK_TIMEOUT;
 
     enum level { DEBUG = 0, INFO, TRACE, WARN, ERROR, FATAL };
     static const char *level_str[6];
 
+    /**
+     * SHARED_BUFFER: all producers append to one mutex-protected buffer.
+     * THREAD_RING: each producer thread owns a lock-free SPSC ring,
+     * registered the first time it logs. The rings can be spread over
+     * several writer shards, each writing its own log file.
+     * PERSISTENT_RING: all producers append to one mutex-protected ring in
+     * a shared mapping of FileOptions::persist_path. The writer releases
+     * lines only once they reached the log file, so lines queued when the
+     * process crashes are recovered by the next init, possibly twice.
+     */
+    enum async_mode { SHARED_BUFFER = 0, THREAD_RING, PERSISTENT_RING };
+
+    /**
+     * What async-mode does with a line when the queue is full.
+     * BLOCK: waits for the writer up to the block timeout, then drops it.
+     * DROP_NEWEST: drops the line.
+     * DROP_OLDEST: drops the oldest queued buffer to make room. A ring can
+     * only be drained by the writer, so THREAD_RING and PERSISTENT_RING drop
+     * the line instead.
+     * KEEP_SEVERE: ERROR and FATAL lines behave as BLOCK, others are dropped.
+     */
+    enum overflow_policy { BLOCK = 0, DROP_NEWEST, DROP_OLDEST, KEEP_SEVERE };
+
+    /**
+     * Line layout written by the default NewLine.
+     * TEXT: [LEVEL][TID: ..][FILE: ..][FUNC: ..][LINE: ..][time] msg k=v
+     * LOGFMT: time="..." level=LEVEL tid=.. file=.. func=.. line=.. msg="..."
+     * k=v
+     * JSON: {"time":"...","level":"LEVEL","tid":..,"file":"..","func":"..",
+     * "line":..,"msg":"...","k":v}
+     * TEXT writes key-value fields where they are streamed, LOGFMT and JSON
+     * move them after the message.
+     */
+    enum line_format { TEXT = 0, LOGFMT, JSON };
+
+    /**
+     * Exact counters of the overflow policy.
+     */
+    struct OverflowStats {
+        uint64_t blocked;         // Lines that waited for the writer.
+        uint64_t timed_out;       // Lines dropped after waiting.
+        uint64_t dropped_lines;   // Lines dropped, including timed out ones.
+        uint64_t dropped_buffers; // Buffers dropped by DROP_OLDEST.
+        uint64_t dropped_bytes;   // Bytes of dropped lines and buffers.
+    };
+
+    /**
+     * Counters of the background compression of rotated files.
+     * Ratio is bytes_out / bytes_in, throughput is bytes_in / nanos.
+     */
+    struct CompressionStats {
+        uint64_t files;     // Files compressed.
+        uint64_t failed;    // Files left uncompressed because of errors.
+        uint64_t bytes_in;  // Uncompressed bytes.
+        uint64_t bytes_out; // Compressed bytes.
+        uint64_t nanos;     // Thread time spent compressing and writing.
+    };
+
+    /**
+     * Snapshot of the runtime counters, subsuming overflow_stats and
+     * compression_stats.
+     */
+    struct Stats {
+        uint64_t submitted_lines;    // Lines handed to the logger.
+        uint64_t submitted_bytes;    // Bytes of those lines.
+        uint64_t written_bytes;      // Bytes handed to the log files.
+        uint64_t file_bytes;         // Bytes the log files wrote out.
+        uint64_t queued_bytes;       // Bytes waiting for the writer now.
+        uint64_t queued_buffers;     // Full buffers waiting. (SHARED_BUFFER)
+        uint64_t buffer_allocations; // Buffers allocated by producers.
+        uint64_t pooled_buffers;     // Free buffers in the buffer pool.
+        uint64_t flushes;            // Writer cycles, writing and flushing.
+        uint64_t wakeups;            // Writer wake-ups by producers.
+        // Writer cycles taking under 2^i microseconds, the last bucket
+        // counts the longer ones too.
+        uint64_t flush_latency[FLUSH_BUCKETS];
+        uint64_t commits;       // fdatasync group commits.
+        uint64_t durable_lines; // Lines that waited to be durable.
+        uint64_t failed_commits;       // Commits whose fdatasync failed.
+        // Durable lines not known to be on disk: failed by a commit, or
+        // dropped in async-mode, e.g. as larger than the ring.
+        uint64_t failed_durable_lines;
+        // Waits of durable lines taking under 2^i microseconds, the last
+        // bucket counts the longer ones too.
+        uint64_t commit_latency[FLUSH_BUCKETS];
+        uint64_t rotations;   // Log files rolled.
+        uint64_t writes;      // write(2), pwrite(2) and io_uring waits.
+        uint64_t write_nanos; // Time spent in them.
+        OverflowStats overflow;
+        CompressionStats compression;
+    };
+
+    /**
+     * Counters of a sink added with add_sink.
+     */
+    struct SinkStats {
+        uint64_t lines;         // Lines queued for the sink.
+        uint64_t bytes;         // Bytes queued for the sink.
+        uint64_t dropped_lines; // Lines dropped because its queue was full.
+        uint64_t dropped_bytes; // Bytes of dropped lines.
+    };
+
     ~Logger();
 
     // Singleton.
@@ -44,71 +220,537 @@ class Logger : Noncopyable {
      * @param path: log file path.
      * @param roll_size: log file roll size.
      * @param buffer_size: internal buffer size.
-     * @param flush_interval: auto flush time interval. (only used in
-     * async-mode)
+     * @param flush_interval: longest wait of a line for the writer, see
+     * set_flush_policy. (only used in async-mode)
+     * @param options: log file options.
+     * @throw: std::system_error if the persist_path file cannot be mapped.
      */
     void init(const std::string &path = DEFAULT_PATH,
               off_t roll_size = DEFAULT_ROLL_SIZE,
               size_t buffer_size = DEFUALT_BUFFER_SIZE,
-              std::chrono::seconds flush_interval = DEFAULT_FLUSH_INTERVAL);
+              std::chrono::microseconds flush_interval =
+                  DEFAULT_FLUSH_INTERVAL,
+              const FileOptions &options = FileOptions());
 
     /**
      * Turns on async-mode.
+     * @param mode: how producers hand log lines to the writer.
+     * @param ring_size: per-thread ring size. (only used in THREAD_RING mode)
+     * Lines larger than a ring are dropped, durable ones included, and
+     * counted in OverflowStats and Stats::failed_durable_lines.
+     * PERSISTENT_RING mode uses FileOptions::persist_size instead.
+     * @param shards: number of writer threads, rings are assigned to them
+     * round-robin in registration order. Shard 0 writes the log file, shard
+     * k writes nijika-pid-k-date-time-seq.log files, which nilog-merge
+     * recombines by timestamp. (only used in THREAD_RING mode)
+     * @throw: std::logic_error if PERSISTENT_RING is asked for without
+     * FileOptions::persist_path.
      */
-    void async_run();
+    void async_run(async_mode mode = SHARED_BUFFER,
+                   size_t ring_size = DEFAULT_RING_SIZE, unsigned shards = 1);
 
     /**
      * Turns off async-mode.
      */
     void async_stop();
 
+    /**
+     * Waits until the writers have written everything submitted before the
+     * call to the log files, without stopping them. Sequence numbers, no
+     * extra writer cycle when one is due anyway, and concurrent calls are
+     * served by the same cycle.
+     * @param durable: also waits until it is on disk, (fdatasync) in the
+     * same group commit as durable lines, see set_durable_level.
+     * @throw: std::logic_error if called before init. std::system_error if
+     * durable and the fdatasync failed, the data is not known to be on disk.
+     */
+    void flush(bool durable = false) { flush_async(durable).get(); }
+
+    /**
+     * Non-blocking flush, e.g. to await durability from an event loop
+     * without tying up a thread.
+     * @param durable: also waits until it is on disk.
+     * @return: a future ready once the data is written, or on disk. It
+     * holds a std::system_error if durable and the fdatasync failed.
+     * @throw: std::logic_error if called before init.
+     */
+    std::future<void> flush_async(bool durable = false);
+
+    /**
+     * Backs the SHARED_BUFFER buffers with a pool of pre-faulted buffers,
+     * which the writer recycles to producers, so once warmed up async-mode
+     * never calls the allocator or takes a page fault. Buffers needed
+     * beyond the pool are allocated, see Stats::buffer_allocations.
+     * Must be called after init and outside async-mode.
+     * @param count: number of buffers of the init buffer size. Producers and
+     * the writer hold four, the rest backs the queue. 0 removes the pool.
+     * @param huge_pages: backs the pool with MAP_HUGETLB pages, falling back
+     * to transparent huge pages.
+     * @param locked: mlock(2)s the pool, if RLIMIT_MEMLOCK allows.
+     * @throw: std::logic_error if called before init or in async-mode.
+     * std::system_error if the pool cannot be mapped.
+     */
+    void set_buffer_pool(size_t count, bool huge_pages = false,
+                         bool locked = false);
+
+    /**
+     * Sets the overflow policy of async-mode.
+     * @param policy: what to do when the queue is full.
+     * @param max_queue_size: cap on the bytes queued for the writer in
+     * SHARED_BUFFER mode. In THREAD_RING mode each ring is capped by its size.
+     * @param block_timeout: maximum wait of a blocked line.
+     */
+    void set_overflow_policy(
+        overflow_policy policy, size_t max_queue_size = DEFAULT_MAX_QUEUE_SIZE,
+        std::chrono::milliseconds block_timeout = DEFAULT_BLOCK_TIMEOUT);
+
+    /**
+     * Sets when the writers of async-mode write what is queued. A writer
+     * sleeps until the first line of a batch, then writes the batch once
+     * that line has waited max_latency, or earlier once max_batch bytes are
+     * queued: a few lines at a time under light load, large batches under
+     * heavy load. Producers wake it up twice per batch at most.
+     * @param max_latency: longest wait of a line, down to microseconds.
+     * @param max_batch: queued bytes written without waiting any longer,
+     * per ring in THREAD_RING mode. 0 for one buffer, (default) or half the
+     * ring in ring modes.
+     */
+    void set_flush_policy(std::chrono::microseconds max_latency,
+                          size_t max_batch = 0);
+
+    /**
+     * @return: a snapshot of the overflow counters.
+     */
+    OverflowStats overflow_stats() const;
+
+    /**
+     * @return: a snapshot of the compression counters.
+     */
+    CompressionStats compression_stats() const;
+
+    /**
+     * Producers count lines in per-thread counters, writers in relaxed
+     * atomics, so the counters cost no shared writes on the hot path.
+     * @return: a snapshot of all the counters.
+     */
+    Stats stats() const;
+
+    /**
+     * Adds a sink written besides the log file, by its own thread from its
+     * own queue. Lines below the sink threshold are never copied to the
+     * queue, and a full queue drops lines rather than blocking producers.
+     * @param sink: the sink.
+     * @param threshold: minimum level of lines written to the sink. Lines
+     * below the runtime threshold are discarded before reaching any sink.
+     * @param buffer_size: size of each queue buffer, longer lines are cut.
+     * @param max_queue_size: cap on the bytes queued for the sink.
+     * @return: id of the sink, for sink_stats.
+     * @throw: std::logic_error if MAX_SINKS sinks were already added.
+     */
+    size_t add_sink(std::shared_ptr<LogSink> sink, level threshold = DEBUG,
+                    size_t buffer_size = DEFAULT_SINK_BUFFER_SIZE,
+                    size_t max_queue_size = DEFAULT_SINK_QUEUE_SIZE);
+
+    /**
+     * @param id: id returned by add_sink.
+     * @return: a snapshot of the counters of the sink.
+     */
+    SinkStats sink_stats(size_t id) const;
+
+    /**
+     * Sets the runtime level threshold. Lines below it are discarded, and
+     * the NIJIKA_LOG_* macros skip evaluating their operands.
+     * @param lvl: minimum level to write.
+     */
+    void set_threshold(level lvl) noexcept {
+        threshold_.store(lvl, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return: the runtime level threshold.
+     */
+    level threshold() const noexcept {
+        return (level)threshold_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the level from which lines wait until they are on disk before
+     * LogStream::flush returns, e.g. ERROR. Lines can also be marked with
+     * the durable manipulator. In async-mode each writer makes all the
+     * lines waiting on it durable with a single fdatasync per cycle (group
+     * commit), lower levels stay fire-and-forget. Durable lines are never
+     * dropped by the overflow policy, they wait for space without timeout,
+     * but a line larger than the ring is still dropped.
+     * In sync-mode every durable line is fdatasync()ed on its own. A failed
+     * fdatasync is reported on stderr and counted in Stats, its lines are
+     * then not counted as durable.
+     * @param lvl: minimum level to wait for, FATAL + 1 for none (default).
+     */
+    void set_durable_level(int lvl) noexcept {
+        durable_level_.store(lvl, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return: the level from which lines wait until they are on disk.
+     */
+    int durable_level() const noexcept {
+        return durable_level_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @return: true if lines of the level pass the runtime threshold.
+     */
+    static bool enabled(level lvl) noexcept {
+        return lvl >= threshold_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the layout of the lines started after the call.
+     * @param format: TEXT, LOGFMT or JSON.
+     */
+    void set_format(line_format format) noexcept {
+        format_.store(format, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return: the line layout.
+     */
+    line_format format() const noexcept {
+        return (line_format)format_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Sets the time zone of log line timestamps.
+     * @param zone: LOCAL, UTC or FIXED. UTC and FIXED never look up the
+     * system time zone.
+     * @param offset: offset from UTC. (only used by FIXED)
+     */
+    void set_time_zone(TimestampFormatter::zone zone,
+                       std::chrono::seconds offset = std::chrono::seconds(0));
+
+    /**
+     * Formats a timestamp in the configured time zone, using a per-thread
+     * cache of the current second.
+     * @param out: destination, at least TimestampFormatter::LENGTH bytes.
+     * @param tp: time point to format.
+     */
+    void format_timestamp(char *out, std::chrono::system_clock::time_point tp);
+
   private:
+    static std::atomic<int> threshold_; // Runtime level threshold.
+
     std::unique_ptr<LogFile> output_; // Log file.
-    std::mutex mut_;                  // For thread satety.
+    bool binary_;                     // Binary log file format.
+    std::string path_;                // Log file path, for shard files.
+    off_t roll_size_;                 // Log file roll size.
+    FileOptions options_;             // Log file options.
+    mutable std::mutex mut_;          // For thread satety.
 
     std::unique_ptr<std::thread> writer_;   // Writing thread(consumer).
     std::atomic<bool> run_;                 // Async-mode indicator.
     std::condition_variable cv_;            // For blocking consumer(writer).
     std::unique_ptr<CountDownLatch> latch_; // For safely turning on async-mode.
 
-    std::chrono::seconds flush_interval_; // Auto flush time interval.
-    size_t buffer_size_;                  // Internal buffer size.
-    FixedBuffer curr_buf_;                // Current user buffer.
-    FixedBuffer next_buf_;                // Backup user buffer.
-    std::vector<FixedBuffer> buffers_;    // Buffer queue.
+    std::atomic<long> max_latency_;    // Longest wait of a line in us.
+    std::atomic<size_t> max_batch_;    // Bytes written without waiting.
+    size_t buffer_size_;               // Internal buffer size.
+    std::unique_ptr<BufferPool> pool_; // Outlives the buffers below.
+    FixedBuffer curr_buf_;             // Current user buffer.
+    FixedBuffer next_buf_;             // Backup user buffer.
+    std::vector<FixedBuffer> buffers_; // Buffer queue.
+    size_t batch_bytes_;               // Queued since the last take.
+    std::chrono::steady_clock::time_point batch_begin_; // Its first line.
+    bool writer_idle_;                 // Writer waits for a first line.
+    bool writer_pending_;              // Writer notified, under mut_.
+    size_t queued_durable_;            // Durable lines queued, under mut_.
+    std::atomic<uint64_t> wakeups_;    // See Stats.
+
+    std::atomic<int> policy_;            // Overflow policy.
+    std::atomic<size_t> max_queue_size_; // Cap on queued bytes.
+    std::atomic<long> block_timeout_;    // Maximum wait in milliseconds.
+    std::condition_variable space_cv_;   // For blocking producers.
+
+    std::atomic<uint64_t> blocked_;         // See OverflowStats.
+    std::atomic<uint64_t> timed_out_;       // See OverflowStats.
+    std::atomic<uint64_t> dropped_lines_;   // See OverflowStats.
+    std::atomic<uint64_t> dropped_buffers_; // See OverflowStats.
+    std::atomic<uint64_t> dropped_bytes_;   // See OverflowStats.
+    uint64_t reported_lines_;               // Reported by writer.
+    uint64_t reported_buffers_;             // Reported by writer.
+
+    std::atomic<int> time_zone_;    // Time zone of timestamps.
+    std::atomic<long> time_offset_; // Offset of FIXED time zone in seconds.
+    std::atomic<int> format_;       // Line layout.
+
+    struct GroupCommit;
+    struct Barrier;
+
+    std::atomic<int> durable_level_;      // Lines from it wait for disk.
+    std::unique_ptr<GroupCommit> commit_; // Tickets of the single writer.
+    std::atomic<uint64_t> commits_;       // See Stats.
+    std::atomic<uint64_t> durable_lines_; // See Stats.
+    std::atomic<uint64_t> failed_commits_;       // See Stats.
+    std::atomic<uint64_t> failed_durable_lines_; // See Stats.
+    std::atomic<uint64_t> commit_latency_[FLUSH_BUCKETS]; // See Stats.
+
+    struct ThreadRing;
+    struct RingHandle;
+    struct RingShard;
+
+    async_mode mode_;                                // Current async mode.
+    size_t ring_size_;                               // Per-thread ring size.
+    mutable std::mutex rings_mut_;                   // Guards rings_.
+    std::vector<std::shared_ptr<ThreadRing>> rings_; // Registered rings.
+    size_t ring_seq_;                                // Guarded by rings_mut_.
+    std::vector<std::unique_ptr<RingShard>> shards_; // Set under rings_mut_.
+
+    std::unique_ptr<PersistentRing> persist_; // Queue of PERSISTENT_RING.
+
+    struct ThreadStats;
+    struct StatsHandle;
+
+    mutable std::mutex stats_mut_; // Guards the three below.
+    std::vector<std::shared_ptr<ThreadStats>> thread_stats_; // Live threads.
+    uint64_t retired_lines_; // Lines of exited threads.
+    uint64_t retired_bytes_; // Bytes of exited threads.
+
+    std::atomic<uint64_t> written_bytes_;                // See Stats.
+    std::atomic<uint64_t> buffer_allocations_;           // See Stats.
+    std::atomic<uint64_t> flushes_;                      // See Stats.
+    std::atomic<uint64_t> flush_latency_[FLUSH_BUCKETS]; // See Stats.
+
+    // Sinks are never removed, so producers read them without locking.
+    std::unique_ptr<SinkWriter> sinks_[MAX_SINKS]; // Added sinks.
+    std::atomic<size_t> sink_count_;               // Published sinks.
+    std::atomic<int> sink_threshold_;              // Lowest sink threshold.
+    std::mutex sinks_mut_;                         // Serializes add_sink.
 
     // Log system front-end.
     friend class LogStream;
+    friend class BinaryLog;
 
     // Singleton
     Logger();
 
     /**
      * Interface for logstream, called by logstream::flush();
-     * @param line: a log line.
+     * @param line: pointer to a log line.
+     * @param len: size of the log line.
+     * @param lvl: level of the log line.
+     * @param durable: waits until the line is on disk, whatever its level,
+     * see set_durable_level.
+     */
+    void write(const char *line, size_t len, level lvl, bool durable = false);
+
+    /**
+     * Hands data to sync-mode or async-mode as is.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     * @param lvl: level of the data, used by the overflow policy.
+     * @param durable: waits until the data is on disk, the durable level is
+     * up to the caller.
      */
-    void write(const std::string &line);
+    void submit(const char *data, size_t len, level lvl, bool durable);
+
+    /**
+     * Copies data to the sinks accepting the level.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     * @param lvl: level of the data.
+     */
+    void write_sinks(const char *data, size_t len, level lvl);
 
     /**
      * Called by write in sync-mode, possibly blocking calling thread.
-     * @param line: a log line.
+     * @param line: pointer to a log line.
+     * @param len: size of the log line.
+     * @param durable: fdatasync()s the line.
+     * @return: 0, or the errno of a failed fdatasync.
      */
-    void sync_write(const std::string &line);
+    int sync_write(const char *line, size_t len, bool durable);
 
     /**
      * Called by write in async-mode.
-     * @param line: a log line.
+     * @param line: pointer to a log line.
+     * @param len: size of the log line.
+     * @param lvl: level of the log line.
+     * @param durable: the line waits for the disk, it is never dropped.
+     * @return: false if the line was dropped.
+     */
+    bool async_write(const char *line, size_t len, level lvl, bool durable);
+
+    /**
+     * Called by write in async-mode with PERSISTENT_RING.
+     * @param line: pointer to a log line.
+     * @param len: size of the log line.
+     * @param lvl: level of the log line.
+     * @param durable: the line waits for the disk, it is never dropped.
+     * @return: false if the line was dropped.
+     */
+    bool persist_write(const char *line, size_t len, level lvl,
+                       bool durable);
+
+    /**
+     * Counts bytes queued by a producer, waking up the writer on the first
+     * line of a batch if it is idle, and once the batch is large enough.
+     * Called under mut_, by async_write and persist_write.
+     * @param len: size of the bytes queued.
+     * @param durable: whether they are a durable line.
+     */
+    void add_to_batch(size_t len, bool durable);
+
+    /**
+     * @return: the queued bytes written without waiting any longer, see
+     * set_flush_policy.
+     */
+    size_t batch_limit() const;
+
+    /**
+     * Writes lines left in the persist_path file by a crashed process to the
+     * log file, or binary records to a file of their own.
+     */
+    void recover_persisted();
+
+    /**
+     * Takes a buffer from the pool, allocating one if there is none.
+     */
+    FixedBuffer take_buffer();
+
+    /**
+     * Called by write in async-mode with THREAD_RING.
+     * @param line: pointer to a log line.
+     * @param len: size of the log line.
+     * @param lvl: level of the log line.
+     * @param durable: the line waits for the disk, it is never dropped.
+     * @return: false if the line was dropped.
+     */
+    bool ring_write(const char *line, size_t len, level lvl, bool durable);
+
+    /**
+     * Counts a line dropped by the overflow policy.
+     */
+    void drop_line(size_t len);
+
+    /**
+     * @return: true if the policy lets a line of the level wait for space,
+     * always for durable lines, which wait without timeout.
+     */
+    bool may_block(level lvl, bool durable) const;
+
+    /**
+     * Writes a notice about lines dropped since the last call.
+     */
+    void report_drops();
+
+    /**
+     * Gets the calling thread's counters, registering them on first use.
+     */
+    ThreadStats &local_stats();
+
+    /**
+     * Folds the counters of an exiting thread into the totals.
+     */
+    void retire_stats(const std::shared_ptr<ThreadStats> &stats);
+
+    /**
+     * Counts a writer cycle.
+     * @param begin: start time of the cycle.
+     */
+    void count_flush(std::chrono::steady_clock::time_point begin);
+
+    /**
+     * Waits in async-mode until the line just queued by the calling thread
+     * is on disk, waking up its writer.
+     * @return: 0, or the errno of the commit that failed the line.
+     */
+    int wait_durable();
+
+    /**
+     * Wakes up all the writers of the current async mode.
+     */
+    void wake_writers();
+
+    /**
+     * Completes the tickets read before taking the data, with a single
+     * fdatasync if any needs the disk, then wakes up their producers and
+     * passes their barriers. (writer side)
+     * @param gc: tickets of the writer.
+     * @param output: log file of the writer, flushed already.
+     */
+    void group_commit(GroupCommit &gc, LogFile &output);
+
+    /**
+     * fdatasync()s a log file, counting the commit, and reports a failure.
+     * @return: 0, or the errno of the failure.
+     */
+    int commit(LogFile &output);
+
+    /**
+     * Wakes up the producers and barriers still waiting on a writer that
+     * has exited.
+     */
+    void release_durable(GroupCommit &gc);
+
+    /**
+     * Gets the calling thread's ring, registering it on first use.
      */
-    void async_write(const std::string &line);
+    ThreadRing &local_ring();
+
+    /**
+     * Wakes up the writer of a ring in THREAD_RING mode.
+     */
+    void notify_writer(const ThreadRing &tr);
 
     /**
      * Writing thread routine.
      */
     void writer_func();
-};
 
-// extern size_t write_submit;
-// extern size_t async_write_submit;
+    /**
+     * Waits until the writer has a batch to write, see set_flush_policy.
+     * Used by writer_func and persist_writer_func.
+     * @param lock: holds mut_.
+     */
+    void wait_batch(std::unique_lock<std::mutex> &lock);
+
+    /**
+     * Writing thread routine in PERSISTENT_RING mode.
+     */
+    void persist_writer_func();
+
+    /**
+     * Writes the persistent ring to the log file, then releases it.
+     */
+    void drain_persisted();
+
+    /**
+     * Writing thread routine in THREAD_RING mode.
+     * @param index: index of the shard.
+     */
+    void ring_writer_func(size_t index);
+
+    /**
+     * Drains the registered rings of a shard into its log file.
+     * @param index: index of the shard.
+     * @return: size of the data drained.
+     */
+    size_t drain_rings(size_t index);
+
+    /**
+     * Drains a ring into a log file in whole records, or lines, so file
+     * headers and rolls fall between them. A record cut by the end of the
+     * ring or by the file buffer size is copied whole first.
+     * @param ring: SpscRing or PersistentRing, read by the caller only.
+     * @param output: log file.
+     * @return: size of the data drained.
+     */
+    template <typename Ring> size_t drain_records(Ring &ring, LogFile &output);
+
+    /**
+     * @return: size of the leading whole records, or lines, of data.
+     */
+    size_t whole_records(const char *data, size_t len) const;
+};
 
 } // namespace log
 
@@ -0,0 +1,113 @@
+#include "log/SinkWriter.h"
+
+#include <algorithm>
+
+namespace nijika {
+
+namespace log {
+
+SinkWriter::SinkWriter(std::shared_ptr<LogSink> sink, Logger::level threshold,
+                       size_t buffer_size, size_t max_queue_size,
+                       std::chrono::milliseconds flush_interval)
+    : sink_(std::move(sink)), threshold_(threshold), buffer_size_(buffer_size),
+      max_buffers_(std::max(max_queue_size / buffer_size, (size_t)1)),
+      flush_interval_(flush_interval), curr_buf_(buffer_size), stop_(false),
+      lines_(0), bytes_(0), dropped_lines_(0), dropped_bytes_(0) {
+    buffers_.reserve(max_buffers_);
+    spare_.emplace_back(buffer_size_);
+    thread_ = std::thread(&SinkWriter::writer_func, this);
+}
+
+SinkWriter::~SinkWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mut_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void SinkWriter::write(const char *data, size_t len) {
+    // A line larger than a whole buffer can never fit.
+    len = std::min(len, buffer_size_);
+
+    std::lock_guard<std::mutex> lock(mut_);
+
+    if (curr_buf_.avail() < len) {
+        if (buffers_.size() >= max_buffers_) {
+            dropped_lines_.fetch_add(1, std::memory_order_relaxed);
+            dropped_bytes_.fetch_add(len, std::memory_order_relaxed);
+            return;
+        }
+
+        buffers_.emplace_back(std::move(curr_buf_));
+        if (!spare_.empty()) {
+            curr_buf_ = std::move(spare_.back());
+            spare_.pop_back();
+        } else {
+            curr_buf_ = FixedBuffer(buffer_size_);
+        }
+        cv_.notify_one();
+    }
+
+    curr_buf_.append(data, len);
+    lines_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(len, std::memory_order_relaxed);
+}
+
+Logger::SinkStats SinkWriter::stats() const {
+    Logger::SinkStats stats;
+    stats.lines = lines_.load(std::memory_order_relaxed);
+    stats.bytes = bytes_.load(std::memory_order_relaxed);
+    stats.dropped_lines = dropped_lines_.load(std::memory_order_relaxed);
+    stats.dropped_bytes = dropped_bytes_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void SinkWriter::writer_func() {
+    std::vector<FixedBuffer> buffers_to_write;
+    buffers_to_write.reserve(max_buffers_ + 1);
+
+    bool stop = false;
+    while (!stop) {
+        {
+            std::unique_lock<std::mutex> lock(mut_);
+            if (buffers_.empty() && !stop_) {
+                cv_.wait_for(lock, flush_interval_);
+            }
+            stop = stop_;
+
+            if (!curr_buf_.empty()) {
+                buffers_.emplace_back(std::move(curr_buf_));
+                if (!spare_.empty()) {
+                    curr_buf_ = std::move(spare_.back());
+                    spare_.pop_back();
+                } else {
+                    curr_buf_ = FixedBuffer(buffer_size_);
+                }
+            }
+            buffers_to_write.swap(buffers_);
+        }
+
+        for (auto &&buffer : buffers_to_write) {
+            sink_->write(buffer.data(), buffer.bytes());
+        }
+        if (!buffers_to_write.empty()) {
+            sink_->flush();
+        }
+
+        // Keep two buffers for reuse, as the main writer does.
+        std::lock_guard<std::mutex> lock(mut_);
+        for (auto &&buffer : buffers_to_write) {
+            if (spare_.size() < 2) {
+                buffer.clear();
+                spare_.emplace_back(std::move(buffer));
+            }
+        }
+        buffers_to_write.clear();
+    }
+}
+
+} // namespace log
+
+} // namespace nijika
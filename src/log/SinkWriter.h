@@ -0,0 +1,93 @@
+#pragma once
+
+#include "log/LogSink.h"
+#include "log/Logger.h"
+#include "util/FixedBuffer.h"
+#include "util/Noncopyable.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nijika {
+
+namespace log {
+
+using namespace util;
+
+/**
+ * Queue and drain thread of one sink. Producers append to the current
+ * buffer, full buffers are queued for the thread, as in SHARED_BUFFER mode.
+ * A full queue drops lines instead of blocking, so a stalled sink only
+ * loses its own data.
+ * @thread-safety: safe.
+ */
+class SinkWriter : Noncopyable {
+  public:
+    /**
+     * Starts the drain thread.
+     * @param sink: the sink.
+     * @param threshold: minimum level of lines written to the sink.
+     * @param buffer_size: size of each queue buffer.
+     * @param max_queue_size: cap on the queued bytes.
+     * @param flush_interval: maximum delay of a line.
+     */
+    SinkWriter(std::shared_ptr<LogSink> sink, Logger::level threshold,
+               size_t buffer_size, size_t max_queue_size,
+               std::chrono::milliseconds flush_interval);
+
+    /**
+     * Writes the queued data and stops the drain thread.
+     */
+    ~SinkWriter();
+
+    /**
+     * @return: true if lines of the level are written to the sink.
+     */
+    bool accepts(Logger::level lvl) const noexcept { return lvl >= threshold_; }
+
+    /**
+     * Queues data for the sink, dropping it if the queue is full.
+     * @param data: pointer to the data.
+     * @param len: size of the data.
+     */
+    void write(const char *data, size_t len);
+
+    /**
+     * @return: a snapshot of the counters.
+     */
+    Logger::SinkStats stats() const;
+
+  private:
+    std::shared_ptr<LogSink> sink_;   // The sink.
+    Logger::level threshold_;         // Level filter.
+    size_t buffer_size_;              // Size of each buffer.
+    size_t max_buffers_;              // Cap on queued buffers.
+    std::chrono::milliseconds flush_interval_; // Maximum delay of a line.
+
+    std::thread thread_;               // Drain thread.
+    std::mutex mut_;                   // Guards the fields below.
+    std::condition_variable cv_;       // For the drain thread.
+    FixedBuffer curr_buf_;             // Buffer being filled.
+    std::vector<FixedBuffer> buffers_; // Full buffers.
+    std::vector<FixedBuffer> spare_;   // Written buffers for reuse.
+    bool stop_;                        // Stops the drain thread.
+
+    std::atomic<uint64_t> lines_;         // See SinkStats.
+    std::atomic<uint64_t> bytes_;         // See SinkStats.
+    std::atomic<uint64_t> dropped_lines_; // See SinkStats.
+    std::atomic<uint64_t> dropped_bytes_; // See SinkStats.
+
+    /**
+     * Drain thread routine.
+     */
+    void writer_func();
+};
+
+} // namespace log
+
+} // namespace nijika
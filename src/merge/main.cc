@@ -0,0 +1,145 @@
+#include "log/BinaryLog.h"
+#include "util/Lz4.h"
+#include "util/TimeUtil.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <string.h>
+
+using namespace nijika::log;
+using namespace nijika::util;
+
+/**
+ * A log line of one of the input files.
+ */
+struct Line {
+    const char *time; // Timestamp, TimestampFormatter::LENGTH bytes.
+    const char *data;
+    size_t len;
+};
+
+/**
+ * Finds a "YYYY-mm-dd HH:MM:SS.uuuuuu" timestamp, wherever the line format
+ * puts it.
+ * @return: pointer to the timestamp, nullptr if there is none.
+ */
+static const char *find_timestamp(const char *p, size_t len) {
+    static const char pattern[] = "dddd-dd-dd dd:dd:dd.dddddd";
+    static_assert(sizeof(pattern) - 1 == TimestampFormatter::LENGTH, "");
+
+    for (size_t i = 0; i + TimestampFormatter::LENGTH <= len; ++i) {
+        size_t j = 0;
+        for (; j < TimestampFormatter::LENGTH; ++j) {
+            char c = p[i + j];
+            if (pattern[j] == 'd' ? (c < '0' || c > '9') : c != pattern[j]) {
+                break;
+            }
+        }
+        if (j == TimestampFormatter::LENGTH) {
+            return p + i;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Splits a file into lines. Lines without a timestamp, e.g. continuations
+ * of multi-line messages, keep the timestamp of the line before them.
+ */
+static void split_lines(const std::string &data, std::vector<Line> &lines) {
+    static const char epoch[] = "0000-00-00 00:00:00.000000";
+
+    const char *time = epoch;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        const char *p = data.data() + pos;
+        const char *nl = (const char *)memchr(p, '\n', data.size() - pos);
+        size_t len = nl ? nl - p + 1 : data.size() - pos;
+
+        if (const char *t = find_timestamp(p, len)) {
+            time = t;
+        }
+        lines.push_back({time, p, len});
+        pos += len;
+    }
+}
+
+int main(int argc, char **argv) {
+    std::vector<std::string> files;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            files.clear();
+            break;
+        }
+        files.push_back(arg);
+    }
+
+    if (files.empty()) {
+        std::cerr << "usage: nilog-merge file...\n"
+                  << "  Merges text log files, or their .lz4, by timestamp to\n"
+                  << "  stdout, e.g. the files of all writer shards. Decode\n"
+                  << "  binary log files with nilog-decode first.\n";
+        return 1;
+    }
+
+    // Whole files are kept in memory, lines point into them.
+    std::vector<std::string> contents;
+    contents.reserve(files.size());
+    for (auto &&file : files) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) {
+            std::cerr << file << ": cannot open\n";
+            return 1;
+        }
+
+        std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+
+        uint32_t magic = 0;
+        if (data.size() >= sizeof(magic)) {
+            memcpy(&magic, data.data(), sizeof(magic));
+        }
+        if (magic == Lz4::FRAME_MAGIC) {
+            std::string raw;
+            if (!Lz4::decompress_stream(data.data(), data.size(), raw)) {
+                std::cerr << file << ": corrupted lz4 frame\n";
+                return 1;
+            }
+            data.swap(raw);
+        }
+        if (data.size() >= sizeof(BinaryLog::MAGIC) &&
+            !memcmp(data.data(), BinaryLog::MAGIC, sizeof(BinaryLog::MAGIC))) {
+            std::cerr << file << ": binary log file, decode it first\n";
+            return 1;
+        }
+
+        contents.push_back(std::move(data));
+    }
+
+    std::vector<Line> lines;
+    for (auto &&data : contents) {
+        split_lines(data, lines);
+    }
+
+    // Timestamps have a fixed width, so they compare as strings. Every
+    // shard is only roughly ordered, rings are drained one at a time, so
+    // this is a full sort rather than a k-way merge.
+    std::stable_sort(lines.begin(), lines.end(),
+                     [](const Line &a, const Line &b) {
+                         return memcmp(a.time, b.time,
+                                       TimestampFormatter::LENGTH) < 0;
+                     });
+
+    for (auto &&line : lines) {
+        std::cout.write(line.data, line.len);
+    }
+
+    return 0;
+}
@@ -0,0 +1,46 @@
+#include "util/PersistentRing.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+using namespace nijika::util;
+
+/**
+ * Prints the lines a crashed process left in the file backing its
+ * PERSISTENT_RING queue, without touching the file. Logger::init recovers
+ * them too, this is for processes that never restart. Binary records are
+ * preceded by the site definitions kept in file.sites, so the output is a
+ * binary log file.
+ *
+ * usage: nilog-recover file...
+ */
+int main(int argc, char **argv) {
+    if (argc < 2 || std::string(argv[1]) == "-h" ||
+        std::string(argv[1]) == "--help") {
+        std::cerr << "usage: nilog-recover file...\n"
+                  << "  Prints the lines left unwritten in persist_path "
+                     "files.\n"
+                  << "  Binary log records are printed as a binary log "
+                     "file, decode it with\n"
+                  << "  nilog-decode, one file at a time.\n";
+        return 1;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        std::string lost = PersistentRing::recover(argv[i]);
+        if (lost.empty()) {
+            continue;
+        }
+
+        // Written by BinaryLog::keep_sites in binary mode.
+        std::ifstream in(std::string(argv[i]) + ".sites", std::ios::binary);
+        std::string sites((std::istreambuf_iterator<char>(in)),
+                          std::istreambuf_iterator<char>());
+        std::cout.write(sites.data(), sites.size());
+        std::cout.write(lost.data(), lost.size());
+    }
+
+    return 0;
+}
@@ -1,9 +1,20 @@
-#include "LogStream.h"
+#include "decode/Decoder.h"
+#include "log/BinaryLog.h"
+#include "log/LogStream.h"
 
 #include <chrono>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
 #include <thread>
 
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 void do_write(nijika::log::Logger::level level, int n) {
     nijika::log::LogStream ls(level);
     for (int i = 0; i < n; ++i) {
@@ -12,12 +23,91 @@ void do_write(nijika::log::Logger::level level, int n) {
     }
 }
 
+/**
+ * Writes binary lines from a child process, the logger of this one stays in
+ * text mode, then decodes the file whole, and cut inside its last record.
+ * @return: false if a check fails.
+ */
+bool check_binary() {
+    using namespace nijika::log;
+
+    char dir[] = "/tmp/nilog-test-XXXXXX";
+    if (!mkdtemp(dir)) {
+        return false;
+    }
+    std::string path = std::string(dir) + "/";
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        FileOptions options;
+        options.binary = true;
+        Logger &logger = Logger::get_instance();
+        logger.init(path, Logger::DEFAULT_ROLL_SIZE,
+                    Logger::DEFUALT_BUFFER_SIZE, Logger::DEFAULT_FLUSH_INTERVAL,
+                    options);
+        for (int i = 0; i < 3; ++i) {
+            NIJIKA_BLOG_INFO("round trip {} {} {}", i, "str", 1.5);
+        }
+        logger.flush();
+        _exit(0);
+    }
+    int status;
+    if (pid == -1 || waitpid(pid, &status, 0) == -1 || status != 0) {
+        return false;
+    }
+
+    std::string data;
+    DIR *d = opendir(dir);
+    while (dirent *entry = d ? readdir(d) : nullptr) {
+        std::string name = path + entry->d_name;
+        if (entry->d_name[0] != '.') {
+            std::ifstream in(name, std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(in),
+                        std::istreambuf_iterator<char>());
+            unlink(name.c_str());
+        }
+    }
+    if (d) {
+        closedir(d);
+    }
+    rmdir(dir);
+
+    // Lines decoded from the first len bytes, -1 if decoding fails.
+    auto decode = [&](size_t len) {
+        std::ostringstream out;
+        Decoder decoder(out, nijika::util::TimestampFormatter::UTC);
+        if (!decoder.decode(data.substr(0, len))) {
+            return -1;
+        }
+        std::istringstream in(out.str());
+        int lines = 0;
+        for (std::string line; std::getline(in, line); ++lines) {
+            std::string want =
+                "round trip " + std::to_string(lines) + " str 1.5";
+            if (line.size() < want.size() ||
+                line.compare(line.size() - want.size(), want.size(), want)) {
+                return -1;
+            }
+        }
+        return lines;
+    };
+
+    return decode(data.size()) == 3 && decode(data.size() - 3) == 2;
+}
+
 int main() {
     using namespace nijika::log;
     using namespace std::chrono;
 
     const int n = 1000000;
 
+    bool binary_ok = check_binary();
+    std::cout << "binary round trip: " << (binary_ok ? "ok" : "failed")
+              << "\n";
+    if (!binary_ok) {
+        return 1;
+    }
+
     Logger &logger = Logger::get_instance();
     logger.init();
 
@@ -52,6 +142,23 @@ int main() {
     std::cout << "5 threads async mode: " << dur3 << "ms\n";
     logger.async_stop();
 
+    logger.async_run(Logger::THREAD_RING);
+    auto begin5 = steady_clock::now();
+    std::thread threads3[5] = {
+        std::thread(do_write, Logger::DEBUG, n),
+        std::thread(do_write, Logger::DEBUG, n),
+        std::thread(do_write, Logger::DEBUG, n),
+        std::thread(do_write, Logger::DEBUG, n),
+        std::thread(do_write, Logger::DEBUG, n),
+    };
+    for (auto &&thr : threads3) {
+        thr.join();
+    }
+    auto end5 = steady_clock::now();
+    auto dur5 = duration_cast<milliseconds>(end5 - begin5).count();
+    std::cout << "5 threads async ring mode: " << dur5 << "ms\n";
+    logger.async_stop();
+
     auto begin4 = steady_clock::now();
     std::thread threads2[5] = {
         std::thread(do_write, Logger::TRACE, n),
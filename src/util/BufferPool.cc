@@ -0,0 +1,90 @@
+#include "BufferPool.h"
+
+#include <algorithm>
+#include <system_error>
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace util {
+
+BufferPool::BufferPool(size_t buffer_size, size_t count, bool huge_pages,
+                       bool lock)
+    : buffer_size_(buffer_size), count_(count), base_(nullptr),
+      map_size_(0), huge_pages_(false), locked_(false) {
+    // Page aligned buffers also suit O_DIRECT.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t stride = (buffer_size + page - 1) / page * page;
+    map_size_ = std::max(stride * count, page);
+
+    void *ptr = MAP_FAILED;
+    if (huge_pages) {
+        size_t size = (map_size_ + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+                      HUGE_PAGE_SIZE;
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr != MAP_FAILED) {
+            map_size_ = size;
+            huge_pages_ = true;
+        }
+    }
+    if (ptr == MAP_FAILED) {
+        ptr = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category());
+        }
+        if (huge_pages) {
+            // No reserved huge pages, transparent ones are the next best.
+            madvise(ptr, map_size_, MADV_HUGEPAGE);
+        }
+    }
+    base_ = (char *)ptr;
+
+    // Write to every page, so none is faulted in on the hot path.
+    for (size_t off = 0; off < map_size_; off += page) {
+        base_[off] = 0;
+    }
+    if (lock) {
+        locked_ = mlock(base_, map_size_) == 0;
+    }
+
+    free_.reserve(count);
+    for (size_t i = count; i > 0; --i) {
+        free_.push_back(base_ + (i - 1) * stride);
+    }
+}
+
+BufferPool::~BufferPool() {
+    if (base_) {
+        munmap(base_, map_size_);
+    }
+}
+
+FixedBuffer BufferPool::acquire() {
+    std::lock_guard<std::mutex> lock(mut_);
+    if (free_.empty()) {
+        return FixedBuffer();
+    }
+    char *p = free_.back();
+    free_.pop_back();
+    return FixedBuffer(p, buffer_size_, this);
+}
+
+size_t BufferPool::available() const {
+    std::lock_guard<std::mutex> lock(mut_);
+    return free_.size();
+}
+
+void BufferPool::release(char *p) noexcept {
+    std::lock_guard<std::mutex> lock(mut_);
+    // Never reallocates, the capacity holds every buffer.
+    free_.push_back(p);
+}
+
+} // namespace util
+
+} // namespace nijika
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "FixedBuffer.h"
+#include "Noncopyable.h"
+
+#include <mutex>
+#include <vector>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Bounded pool of equally sized FixedBuffers carved out of one mapping,
+ * which is faulted in up front, so taking a buffer never calls the
+ * allocator or takes a page fault. A buffer returns to the pool when it is
+ * destroyed, wherever that happens. The pool must outlive its buffers.
+ * @thread-safety: safe.
+ */
+class BufferPool : Noncopyable {
+  public:
+    static constexpr size_t HUGE_PAGE_SIZE = 1 << 21; // Aka 2MB.
+
+    /**
+     * Maps and pre-faults the buffers.
+     * @param buffer_size: capacity of each buffer.
+     * @param count: number of buffers.
+     * @param huge_pages: backs the pool with MAP_HUGETLB pages, or asks for
+     * transparent huge pages if none are reserved.
+     * @param lock: mlock(2)s the pool, so it is never swapped out. A failure,
+     * e.g. because of RLIMIT_MEMLOCK, leaves it unlocked.
+     * @throw: std::system_error if the memory cannot be mapped.
+     */
+    BufferPool(size_t buffer_size, size_t count, bool huge_pages = false,
+               bool lock = false);
+
+    ~BufferPool();
+
+    /**
+     * Takes a buffer out of the pool.
+     * @return: an empty buffer, or a null one if the pool is exhausted.
+     */
+    FixedBuffer acquire();
+
+    /**
+     * @return: the number of buffers in the pool now.
+     */
+    size_t available() const;
+
+    /**
+     * @return: the capacity of each buffer.
+     */
+    size_t buffer_size() const noexcept { return buffer_size_; }
+
+    /**
+     * @return: the number of buffers.
+     */
+    size_t count() const noexcept { return count_; }
+
+    /**
+     * @return: true if the pool is backed by MAP_HUGETLB pages.
+     */
+    bool huge_pages() const noexcept { return huge_pages_; }
+
+    /**
+     * @return: true if the pool is locked in memory.
+     */
+    bool locked() const noexcept { return locked_; }
+
+  private:
+    friend class FixedBuffer;
+
+    size_t buffer_size_;       // Capacity of each buffer.
+    size_t count_;             // Number of buffers.
+    char *base_;               // The mapping.
+    size_t map_size_;          // Size of the mapping.
+    bool huge_pages_;          // Backed by MAP_HUGETLB.
+    bool locked_;              // Locked by mlock.
+    mutable std::mutex mut_;   // Guards free_.
+    std::vector<char *> free_; // Buffers in the pool, never reallocated.
+
+    /**
+     * Puts the storage of a destroyed buffer back.
+     */
+    void release(char *p) noexcept;
+};
+
+} // namespace util
+
+} // namespace nijika
@@ -1,5 +1,7 @@
 #include "FixedBuffer.h"
+#include "BufferPool.h"
 
+#include <algorithm>
 #include <stdexcept>
 #include <string.h>
 
@@ -7,6 +9,14 @@ namespace nijika {
 
 namespace util {
 
+void FixedBuffer::Deleter::operator()(char *p) const noexcept {
+    if (pool) {
+        pool->release(p);
+    } else {
+        ::operator delete[](p, alignment);
+    }
+}
+
 void FixedBuffer::append(const char *data, size_t len) {
     if (len > avail()) {
         throw std::out_of_range("Not enough space in the buffer.");
@@ -16,6 +26,12 @@ void FixedBuffer::append(const char *data, size_t len) {
     bytes_ += len;
 }
 
+void FixedBuffer::discard(size_t len) noexcept {
+    len = std::min(len, bytes_);
+    memmove(buf_.get(), buf_.get() + len, bytes_ - len);
+    bytes_ -= len;
+}
+
 FixedBuffer::FixedBuffer(FixedBuffer &&other) noexcept
     : buf_(std::move(other.buf_)), capacity_(other.capacity_),
       bytes_(other.bytes_) {
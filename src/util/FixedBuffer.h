@@ -2,13 +2,17 @@
 
 #include "Noncopyable.h"
 
+#include <cstddef>
 #include <memory>
+#include <new>
 #include <string>
 
 namespace nijika {
 
 namespace util {
 
+class BufferPool;
+
 /**
  * Movable fix-sized output buffer. Forbids copy for the sake of performace.
  * @thread-safety: unsafe.
@@ -20,9 +24,14 @@ class FixedBuffer : Noncopyable {
     /**
      * Constructs a buffer of specified capacity.
      * @param capacity: User specified capacity.
+     * @param alignment: alignment of the storage, e.g. page size for O_DIRECT.
      */
-    explicit FixedBuffer(size_t capacity)
-        : buf_(new char[capacity]), capacity_(capacity), bytes_(0) {}
+    explicit FixedBuffer(size_t capacity,
+                         size_t alignment = alignof(std::max_align_t))
+        : buf_((char *)::operator new[](capacity,
+                                        std::align_val_t(alignment)),
+               Deleter{std::align_val_t(alignment), nullptr}),
+          capacity_(capacity), bytes_(0) {}
 
     FixedBuffer(FixedBuffer &&other) noexcept;
     FixedBuffer &operator=(FixedBuffer &&other) noexcept;
@@ -59,6 +68,11 @@ class FixedBuffer : Noncopyable {
      */
     const char *data() const noexcept { return buf_.get(); }
 
+    /**
+     * @return: a pointer to the empty space, e.g. for padding in place.
+     */
+    char *current() noexcept { return buf_.get() + bytes_; }
+
     /**
      * Appends data to the buffer.
      * @param data: pointer to the user data.
@@ -72,15 +86,41 @@ class FixedBuffer : Noncopyable {
      */
     void append(const std::string &data) { append(data.data(), data.size()); }
 
+    /**
+     * Removes data from the front of the buffer, moving the rest forward.
+     * @param len: number of bytes to remove.
+     */
+    void discard(size_t len) noexcept;
+
     /**
      * @return: true if the buffer is empty.
      */
     bool empty() const noexcept { return bytes_ == 0; }
 
   private:
-    std::unique_ptr<char[]> buf_; // Buffer pointer.
-    size_t capacity_;             // Capacity of the buffer.
-    size_t bytes_;                // Size of data in the buffer.
+    friend class BufferPool;
+
+    /**
+     * Frees the storage, or gives it back to its pool.
+     */
+    struct Deleter {
+        std::align_val_t alignment;
+        BufferPool *pool; // Owner of the storage, nullptr for the heap.
+
+        void operator()(char *p) const noexcept;
+    };
+
+    /**
+     * Constructs a buffer over storage of a pool.
+     */
+    FixedBuffer(char *storage, size_t capacity, BufferPool *pool) noexcept
+        : buf_(storage, Deleter{std::align_val_t(alignof(std::max_align_t)),
+                                pool}),
+          capacity_(capacity), bytes_(0) {}
+
+    std::unique_ptr<char[], Deleter> buf_; // Buffer pointer.
+    size_t capacity_;                      // Capacity of the buffer.
+    size_t bytes_;                         // Size of data in the buffer.
 };
 
 } // namespace util
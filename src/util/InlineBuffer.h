@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Noncopyable.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Fix-sized output buffer with inline storage, so it never touches the heap.
+ * Data beyond the capacity is silently truncated.
+ * @thread-safety: unsafe.
+ */
+template <size_t SIZE> class InlineBuffer : Noncopyable {
+  public:
+    InlineBuffer() noexcept : bytes_(0) {}
+
+    /**
+     * Clear the data in the buffer.
+     */
+    void clear() noexcept { bytes_ = 0; }
+
+    /**
+     * @return: the size of data in the buffer.
+     */
+    size_t bytes() const noexcept { return bytes_; }
+
+    /**
+     * @return: the capacity of the buffer.
+     */
+    static constexpr size_t capacity() noexcept { return SIZE; }
+
+    /**
+     * @return: the size of empty space in the buffer.
+     */
+    size_t avail() const noexcept { return SIZE - bytes_; }
+
+    /**
+     * @return a pointer to the data in the buffer.(read-only)
+     */
+    const char *data() const noexcept { return buf_; }
+
+    /**
+     * @return: a pointer to the empty space, used for formatting in place.
+     */
+    char *current() noexcept { return buf_ + bytes_; }
+
+    /**
+     * Commits bytes written in place through current().
+     * @param len: number of bytes written.
+     */
+    void add(size_t len) noexcept { bytes_ += len; }
+
+    /**
+     * Drops the data beyond a size.
+     * @param len: size to keep, at most bytes().
+     */
+    void resize(size_t len) noexcept { bytes_ = len; }
+
+    /**
+     * Appends data to the buffer, truncating it if there is not enough space.
+     * @param data: pointer to the user data.
+     * @param len: size of the data.
+     */
+    void append(const char *data, size_t len) noexcept {
+        len = std::min(len, avail());
+        memcpy(buf_ + bytes_, data, len);
+        bytes_ += len;
+    }
+
+    /**
+     * @return: true if the buffer is empty.
+     */
+    bool empty() const noexcept { return bytes_ == 0; }
+
+  private:
+    char buf_[SIZE]; // Inline storage.
+    size_t bytes_;   // Size of data in the buffer.
+};
+
+} // namespace util
+
+} // namespace nijika
\ No newline at end of file
@@ -0,0 +1,132 @@
+#include "IoUring.h"
+
+#include <algorithm>
+#include <system_error>
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace util {
+
+static void *map_ring(int fd, size_t size, off_t offset) {
+    void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, offset);
+    if (ptr == MAP_FAILED) {
+        int ec = errno;
+        close(fd);
+        throw std::system_error(ec, std::generic_category());
+    }
+    return ptr;
+}
+
+IoUring::IoUring(unsigned entries) : pending_(0) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    fd_ = syscall(__NR_io_uring_setup, entries, &params);
+    if (fd_ == -1) {
+        // ENOSYS on old kernels, EPERM when disabled by sysctl or seccomp.
+        throw std::system_error(errno, std::generic_category());
+    }
+    sq_entries_ = params.sq_entries;
+
+    sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+    }
+
+    sq_ptr_ = map_ring(fd_, sq_size_, IORING_OFF_SQ_RING);
+    cq_ptr_ = single ? sq_ptr_ : map_ring(fd_, cq_size_, IORING_OFF_CQ_RING);
+    sqes_ = (io_uring_sqe *)map_ring(
+        fd_, params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES);
+
+    char *sq = (char *)sq_ptr_;
+    sq_head_ = (unsigned *)(sq + params.sq_off.head);
+    sq_tail_ = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask_ = (unsigned *)(sq + params.sq_off.ring_mask);
+    sq_array_ = (unsigned *)(sq + params.sq_off.array);
+
+    char *cq = (char *)cq_ptr_;
+    cq_head_ = (unsigned *)(cq + params.cq_off.head);
+    cq_tail_ = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask_ = (unsigned *)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe *)(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    munmap(sqes_, sq_entries_ * sizeof(io_uring_sqe));
+    if (cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_size_);
+    }
+    munmap(sq_ptr_, sq_size_);
+    close(fd_);
+}
+
+bool IoUring::write(int fd, const char *data, size_t len, off_t offset,
+                    uint64_t user_data) noexcept {
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == sq_entries_) {
+        return false;
+    }
+
+    unsigned idx = tail & *sq_mask_;
+    io_uring_sqe *sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)data;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+
+    sq_array_[idx] = idx;
+    // Publish the entry to the kernel.
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    ++pending_;
+    return true;
+}
+
+void IoUring::submit(unsigned wait_nr) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    while (true) {
+        int res = syscall(__NR_io_uring_enter, fd_, pending_, wait_nr, flags,
+                          nullptr, 0);
+        if (res >= 0) {
+            pending_ -= res;
+            return;
+        }
+
+        int ec = errno;
+        if (ec != EINTR) {
+            throw std::system_error(ec, std::generic_category());
+        }
+    }
+}
+
+bool IoUring::reap(uint64_t *user_data, int *res) noexcept {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    const io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+    *user_data = cqe.user_data;
+    *res = cqe.res;
+
+    // Hand the slot back to the kernel.
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+} // namespace util
+
+} // namespace nijika
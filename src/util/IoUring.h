@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Noncopyable.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Minimal io_uring instance for asynchronous file writes, talking to the
+ * kernel through the raw syscalls so no liburing is needed.
+ * @thread-safety: unsafe.
+ */
+class IoUring : Noncopyable {
+  public:
+    /**
+     * Sets up an io_uring instance.
+     * @param entries: submission queue size.
+     * @throw: std::system_error if io_uring is unavailable.
+     */
+    explicit IoUring(unsigned entries);
+
+    ~IoUring();
+
+    /**
+     * Queues a write, which starts on the next submit.
+     * @param fd: file descriptor.
+     * @param data: pointer to the data, must stay valid until completion.
+     * @param len: size of the data.
+     * @param offset: file offset.
+     * @param user_data: returned with the completion.
+     * @return: false if the submission queue is full.
+     */
+    bool write(int fd, const char *data, size_t len, off_t offset,
+               uint64_t user_data) noexcept;
+
+    /**
+     * Submits the queued requests, optionally waiting for completions.
+     * @param wait_nr: number of completions to wait for.
+     * @throw: std::system_error on failure.
+     */
+    void submit(unsigned wait_nr = 0);
+
+    /**
+     * Pops a completion.
+     * @param user_data: receives the user data of the request.
+     * @param res: receives the result, bytes written or -errno.
+     * @return: false if no completion is available.
+     */
+    bool reap(uint64_t *user_data, int *res) noexcept;
+
+  private:
+    int fd_;              // io_uring file descriptor.
+    unsigned sq_entries_; // Submission queue size.
+
+    void *sq_ptr_;       // Mapped submission ring.
+    size_t sq_size_;     // Size of the submission ring mapping.
+    void *cq_ptr_;       // Mapped completion ring, may equal sq_ptr_.
+    size_t cq_size_;     // Size of the completion ring mapping.
+    io_uring_sqe *sqes_; // Mapped submission queue entries.
+
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned *sq_mask_;
+    unsigned *sq_array_;
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned *cq_mask_;
+    io_uring_cqe *cqes_;
+
+    unsigned pending_; // Queued but not yet submitted requests.
+};
+
+} // namespace util
+
+} // namespace nijika
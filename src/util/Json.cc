@@ -0,0 +1,111 @@
+#include "Json.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace nijika {
+
+namespace util {
+
+size_t Json::find_escape(const char *src, size_t len) noexcept {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        // Unsigned v <= 0x1f iff min(v, 0x1f) == v.
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+        int mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; ++i) {
+        unsigned char c = src[i];
+        if (c < 0x20 || c == '"' || c == '\\') {
+            return i;
+        }
+    }
+    return len;
+}
+
+/**
+ * Writes the escape sequence of a character.
+ * @return: its size.
+ */
+static size_t escape_char(unsigned char c, char *out) {
+    static const char hex[] = "0123456789abcdef";
+
+    out[0] = '\\';
+    switch (c) {
+    case '"':
+    case '\\':
+        out[1] = c;
+        return 2;
+    case '\n':
+        out[1] = 'n';
+        return 2;
+    case '\r':
+        out[1] = 'r';
+        return 2;
+    case '\t':
+        out[1] = 't';
+        return 2;
+    case '\b':
+        out[1] = 'b';
+        return 2;
+    case '\f':
+        out[1] = 'f';
+        return 2;
+    default:
+        memcpy(out + 1, "u00", 3);
+        out[4] = hex[c >> 4];
+        out[5] = hex[c & 0xf];
+        return 6;
+    }
+}
+
+size_t Json::escape(char *dst, size_t cap, const char *src, size_t len,
+                    size_t &consumed) noexcept {
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len && out < cap) {
+        // Copy the run of plain bytes at once.
+        size_t run = find_escape(src + in, std::min(len - in, cap - out));
+        memcpy(dst + out, src + in, run);
+        in += run;
+        out += run;
+        if (in == len || out == cap) {
+            break;
+        }
+
+        char esc[MAX_ESCAPE_SIZE];
+        size_t n = escape_char(src[in], esc);
+        if (n > cap - out) {
+            break;
+        }
+        memcpy(dst + out, esc, n);
+        out += n;
+        ++in;
+    }
+
+    consumed = in;
+    return out;
+}
+
+} // namespace util
+
+} // namespace nijika
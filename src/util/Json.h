@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * JSON string escaping, also used for quoted logfmt values. Scans 16 bytes
+ * at a time with SSE2 where available, so long strings without special
+ * characters cost little more than a memcpy. Bytes from 0x80 up are copied
+ * as is, i.e. strings are assumed to be UTF-8.
+ * All functions are reentrant.
+ */
+class Json {
+  public:
+    static constexpr size_t MAX_ESCAPE_SIZE = 6; // "\u001f".
+
+    /**
+     * Finds the first byte needing an escape: '"', '\' or below 0x20.
+     * @param src: pointer to the string.
+     * @param len: size of the string.
+     * @return: its index, len if there is none.
+     */
+    static size_t find_escape(const char *src, size_t len) noexcept;
+
+    /**
+     * Escapes a string, without the surrounding quotes. Stops before the
+     * first character whose escape does not fit, so the output is never cut
+     * in the middle of an escape sequence.
+     * @param dst: destination.
+     * @param cap: size of the destination.
+     * @param src: pointer to the string.
+     * @param len: size of the string.
+     * @param consumed: receives the number of bytes of src escaped.
+     * @return: the number of bytes written.
+     */
+    static size_t escape(char *dst, size_t cap, const char *src, size_t len,
+                         size_t &consumed) noexcept;
+};
+
+} // namespace util
+
+} // namespace nijika
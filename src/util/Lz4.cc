@@ -0,0 +1,390 @@
+#include "Lz4.h"
+
+#include <algorithm>
+
+#include <string.h>
+
+namespace nijika {
+
+namespace util {
+
+static constexpr int HASH_LOG = 14;
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t LAST_LITERALS = 5; // A block ends with literals.
+static constexpr size_t MF_LIMIT = 12;     // No match starts after this.
+static constexpr size_t MAX_OFFSET = 65535;
+
+static inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read_le32(const char *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static inline void append_le32(std::string &out, uint32_t v) {
+    char b[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+    out.append(b, sizeof(b));
+}
+
+static inline uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+static char *write_length(char *op, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = (char)255;
+    }
+    *op++ = (char)len;
+    return op;
+}
+
+// Writes the literals of a sequence, preceded by the token.
+static char *write_literals(char *op, const char *lit, size_t len,
+                            size_t match) {
+    *op++ =
+        (char)(std::min<size_t>(len, 15) << 4 | std::min<size_t>(match, 15));
+    if (len >= 15) {
+        op = write_length(op, len - 15);
+    }
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+// Counts matching bytes, stopping at limit.
+static size_t match_length(const char *a, const char *b, const char *limit) {
+    const char *start = a;
+    while (a + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+        if (x != y) {
+            // Little endian, the first differing byte is the lowest one.
+            return a - start + (__builtin_ctzll(x ^ y) >> 3);
+        }
+        a += 8;
+        b += 8;
+    }
+    while (a < limit && *a == *b) {
+        ++a;
+        ++b;
+    }
+    return a - start;
+}
+
+size_t Lz4::compress(const char *src, size_t len, char *dst) {
+    char *op = dst;
+    size_t anchor = 0;
+
+    if (len > MF_LIMIT) {
+        uint32_t table[1 << HASH_LOG]; // Last position of each hash.
+        memset(table, 0, sizeof(table));
+
+        const size_t limit = len - MF_LIMIT;
+        const char *match_limit = src + len - LAST_LITERALS;
+        size_t ip = 1;
+
+        while (ip < limit) {
+            uint32_t seq = read32(src + ip);
+            uint32_t h = hash(seq);
+            size_t ref = table[h];
+            table[h] = ip;
+
+            if (ip - ref > MAX_OFFSET || read32(src + ref) != seq) {
+                // Step faster through data that does not compress.
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+                --ip;
+                --ref;
+            }
+
+            size_t match = MIN_MATCH + match_length(src + ip + MIN_MATCH,
+                                                    src + ref + MIN_MATCH,
+                                                    match_limit);
+
+            op = write_literals(op, src + anchor, ip - anchor,
+                                match - MIN_MATCH);
+            size_t offset = ip - ref;
+            *op++ = (char)offset;
+            *op++ = (char)(offset >> 8);
+            if (match - MIN_MATCH >= 15) {
+                op = write_length(op, match - MIN_MATCH - 15);
+            }
+
+            ip += match;
+            anchor = ip;
+            if (ip < limit) {
+                table[hash(read32(src + ip - 2))] = ip - 2;
+            }
+        }
+    }
+
+    op = write_literals(op, src + anchor, len - anchor, 0);
+    return op - dst;
+}
+
+// Reads the extra bytes of a length field.
+static bool read_length(const uint8_t *&ip, const uint8_t *end,
+                        size_t &len) {
+    uint8_t b;
+    do {
+        if (ip == end) {
+            return false;
+        }
+        b = *ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+ptrdiff_t Lz4::decompress(const char *src, size_t len, char *dst,
+                          size_t cap) {
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *end = ip + len;
+    char *op = dst;
+    char *op_end = dst + cap;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !read_length(ip, end, lit)) {
+            return -1;
+        }
+        if ((size_t)(end - ip) < lit || (size_t)(op_end - op) < lit) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == end) {
+            break; // The last sequence has no match.
+        }
+
+        if (end - ip < 2) {
+            return -1;
+        }
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+
+        size_t match = token & 15;
+        if (match == 15 && !read_length(ip, end, match)) {
+            return -1;
+        }
+        match += MIN_MATCH;
+        if ((size_t)(op_end - op) < match) {
+            return -1;
+        }
+
+        const char *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+        } else {
+            // Overlapping copy repeats the pattern.
+            for (size_t i = 0; i < match; ++i) {
+                op[i] = ref[i];
+            }
+        }
+        op += match;
+    }
+
+    return op - dst;
+}
+
+std::string Lz4::frame_header(uint64_t content_size) {
+    std::string header;
+    append_le32(header, FRAME_MAGIC);
+    header += (char)0x68; // Version 1, independent blocks, content size.
+    header += (char)0x70; // 4MB blocks.
+    append_le32(header, (uint32_t)content_size);
+    append_le32(header, (uint32_t)(content_size >> 32));
+    header += (char)(xxh32(header.data() + 4, header.size() - 4, 0) >> 8);
+    return header;
+}
+
+void Lz4::frame_block(std::string &out, const char *src, size_t len) {
+    size_t pos = out.size();
+    out.resize(pos + 4 + bound(len));
+
+    char *block = &out[pos + 4];
+    size_t n = compress(src, len, block);
+    uint32_t word = n;
+    if (n >= len) {
+        // Incompressible, store it as is.
+        memcpy(block, src, len);
+        n = len;
+        word = len | 0x80000000;
+    }
+
+    for (int i = 0; i < 4; ++i) {
+        out[pos + i] = (char)(word >> (8 * i));
+    }
+    out.resize(pos + 4 + n);
+}
+
+bool Lz4::decompress_frame(const char *src, size_t len, std::string &out) {
+    const char *end = src + len;
+    if (len < 7 || read_le32(src) != FRAME_MAGIC) {
+        return false;
+    }
+
+    uint8_t flg = src[4];
+    uint8_t bd = src[5];
+    if (flg >> 6 != 1 || !(flg & 0x20)) {
+        return false; // Unknown version or linked blocks.
+    }
+    size_t max_block = (size_t)1 << (8 + 2 * ((bd >> 4) & 7));
+    bool block_checksum = flg & 0x10;
+    const char *p = src + 6 + (flg & 0x08 ? 8 : 0) + (flg & 0x01 ? 4 : 0) + 1;
+
+    while (true) {
+        if (end - p < 4) {
+            return false;
+        }
+        uint32_t word = read_le32(p);
+        p += 4;
+        if (word == 0) {
+            return true; // End mark, the content checksum is not verified.
+        }
+
+        size_t n = word & 0x7fffffff;
+        if ((size_t)(end - p) < n + (block_checksum ? 4 : 0)) {
+            return false;
+        }
+
+        if (word & 0x80000000) {
+            out.append(p, n);
+        } else {
+            size_t pos = out.size();
+            out.resize(pos + max_block);
+            ptrdiff_t res = decompress(p, n, &out[pos], max_block);
+            if (res < 0) {
+                return false;
+            }
+            out.resize(pos + res);
+        }
+        p += n + (block_checksum ? 4 : 0);
+    }
+}
+
+size_t Lz4::frame_size(const char *src, size_t len, uint64_t *content_size) {
+    *content_size = 0;
+    if (len < 8) {
+        return 0;
+    }
+
+    uint32_t magic = read_le32(src);
+    if ((magic & 0xfffffff0) == SKIPPABLE_MAGIC) {
+        size_t n = 8 + (size_t)read_le32(src + 4);
+        return n <= len ? n : 0;
+    }
+    if (magic != FRAME_MAGIC) {
+        return 0;
+    }
+
+    uint8_t flg = src[4];
+    size_t header = 7 + (flg & 0x08 ? 8 : 0) + (flg & 0x01 ? 4 : 0);
+    if (len < header) {
+        return 0;
+    }
+    if (flg & 0x08) {
+        *content_size = read_le32(src + 6) |
+                        (uint64_t)read_le32(src + 10) << 32;
+    }
+
+    bool block_checksum = flg & 0x10;
+    size_t pos = header;
+    while (true) {
+        if (len - pos < 4) {
+            return 0;
+        }
+        uint32_t word = read_le32(src + pos);
+        pos += 4;
+        if (word == 0) {
+            break;
+        }
+
+        size_t n = (word & 0x7fffffff) + (block_checksum ? 4 : 0);
+        if (len - pos < n) {
+            return 0;
+        }
+        pos += n;
+    }
+
+    pos += flg & 0x04 ? 4 : 0; // Content checksum.
+    return pos <= len ? pos : 0;
+}
+
+bool Lz4::decompress_stream(const char *src, size_t len, std::string &out) {
+    size_t pos = 0;
+    while (pos < len) {
+        uint64_t content_size;
+        size_t n = frame_size(src + pos, len - pos, &content_size);
+        if (n == 0) {
+            return false;
+        }
+        if (read_le32(src + pos) == FRAME_MAGIC &&
+            !decompress_frame(src + pos, n, out)) {
+            return false;
+        }
+        pos += n;
+    }
+    return true;
+}
+
+static inline uint32_t rotl(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+uint32_t Lz4::xxh32(const void *data, size_t len, uint32_t seed) {
+    constexpr uint32_t P1 = 2654435761u;
+    constexpr uint32_t P2 = 2246822519u;
+    constexpr uint32_t P3 = 3266489917u;
+    constexpr uint32_t P4 = 668265263u;
+    constexpr uint32_t P5 = 374761393u;
+
+    const char *p = (const char *)data;
+    const char *end = p + len;
+    uint32_t h;
+
+    if (len >= 16) {
+        uint32_t v[4] = {seed + P1 + P2, seed + P2, seed, seed - P1};
+        for (; p + 16 <= end; p += 16) {
+            for (int i = 0; i < 4; ++i) {
+                v[i] = rotl(v[i] + read_le32(p + 4 * i) * P2, 13) * P1;
+            }
+        }
+        h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+    } else {
+        h = seed + P5;
+    }
+
+    h += (uint32_t)len;
+    for (; p + 4 <= end; p += 4) {
+        h = rotl(h + read_le32(p) * P3, 17) * P4;
+    }
+    for (; p < end; ++p) {
+        h = rotl(h + (uint8_t)*p * P5, 11) * P1;
+    }
+
+    h ^= h >> 15;
+    h *= P2;
+    h ^= h >> 13;
+    h *= P3;
+    h ^= h >> 16;
+    return h;
+}
+
+} // namespace util
+
+} // namespace nijika
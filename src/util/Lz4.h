@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Dependency-free LZ4 codec: the block format plus the frame format used by
+ * .lz4 files, so the output can also be read by the standard lz4 tool.
+ * All functions are reentrant.
+ */
+class Lz4 {
+  public:
+    static constexpr uint32_t FRAME_MAGIC = 0x184D2204;
+    static constexpr uint32_t SKIPPABLE_MAGIC = 0x184D2A50; // Low 4 bits free.
+    static constexpr size_t MAX_BLOCK_SIZE = 4 << 20; // Aka 4MB.
+
+    /**
+     * @return: the worst-case compressed size of len bytes.
+     */
+    static constexpr size_t bound(size_t len) { return len + len / 255 + 16; }
+
+    /**
+     * Compresses a block.
+     * @param src: pointer to the data.
+     * @param len: size of the data.
+     * @param dst: destination, at least bound(len) bytes.
+     * @return: size of the compressed block.
+     */
+    static size_t compress(const char *src, size_t len, char *dst);
+
+    /**
+     * Decompresses a block.
+     * @param src: pointer to the compressed block.
+     * @param len: size of the compressed block.
+     * @param dst: destination.
+     * @param cap: capacity of the destination.
+     * @return: size of the decompressed data, -1 if the block is corrupted.
+     */
+    static ptrdiff_t decompress(const char *src, size_t len, char *dst,
+                                size_t cap);
+
+    /**
+     * Builds a frame header for independent blocks of MAX_BLOCK_SIZE.
+     * @param content_size: total size of the uncompressed data.
+     */
+    static std::string frame_header(uint64_t content_size);
+
+    /**
+     * Appends a frame data block, compressed unless that does not pay off.
+     * @param out: destination.
+     * @param src: pointer to the data, at most MAX_BLOCK_SIZE bytes.
+     * @param len: size of the data.
+     */
+    static void frame_block(std::string &out, const char *src, size_t len);
+
+    /**
+     * @return: the end mark of a frame.
+     */
+    static std::string frame_end() { return std::string(4, '\0'); }
+
+    /**
+     * Decompresses a whole frame, as written with the functions above.
+     * @param src: pointer to the frame.
+     * @param len: size of the frame.
+     * @param out: receives the decompressed data.
+     * @return: false if the frame is corrupted or unsupported.
+     */
+    static bool decompress_frame(const char *src, size_t len,
+                                 std::string &out);
+
+    /**
+     * Measures the frame at the beginning of the data, without decompressing
+     * it. Skippable frames are measured too.
+     * @param src: pointer to the data.
+     * @param len: size of the data.
+     * @param content_size: receives the uncompressed size if the frame
+     * header has it, otherwise 0.
+     * @return: size of the frame, 0 if it is corrupted or truncated.
+     */
+    static size_t frame_size(const char *src, size_t len,
+                             uint64_t *content_size);
+
+    /**
+     * Decompresses a sequence of frames, e.g. a whole .lz4 file, skipping
+     * skippable frames.
+     * @param src: pointer to the frames.
+     * @param len: size of the frames.
+     * @param out: receives the decompressed data.
+     * @return: false if a frame is corrupted or unsupported.
+     */
+    static bool decompress_stream(const char *src, size_t len,
+                                  std::string &out);
+
+    /**
+     * xxHash32, used for the frame header checksum.
+     */
+    static uint32_t xxh32(const void *data, size_t len, uint32_t seed);
+};
+
+} // namespace util
+
+} // namespace nijika
@@ -0,0 +1,53 @@
+#include "NumberFormat.h"
+
+#include <charconv>
+
+namespace nijika {
+
+namespace util {
+
+const char NumberFormat::DIGIT_PAIRS[201] =
+    "000102030405060708091011121314151617181920212223242526272829"
+    "303132333435363738394041424344454647484950515253545556575859"
+    "606162636465666768697071727374757677787980818283848586878889"
+    "90919293949596979899";
+
+const uint64_t NumberFormat::POW10[20] = {1ull,
+                                          10ull,
+                                          100ull,
+                                          1000ull,
+                                          10000ull,
+                                          100000ull,
+                                          1000000ull,
+                                          10000000ull,
+                                          100000000ull,
+                                          1000000000ull,
+                                          10000000000ull,
+                                          100000000000ull,
+                                          1000000000000ull,
+                                          10000000000000ull,
+                                          100000000000000ull,
+                                          1000000000000000ull,
+                                          10000000000000000ull,
+                                          100000000000000000ull,
+                                          1000000000000000000ull,
+                                          10000000000000000000ull};
+
+// Shortest round trip is what std::to_chars does without a precision, with
+// the Ryu algorithm in libstdc++.
+
+char *NumberFormat::floating(char *out, float v) noexcept {
+    return std::to_chars(out, out + MAX_SIZE, v).ptr;
+}
+
+char *NumberFormat::floating(char *out, double v) noexcept {
+    return std::to_chars(out, out + MAX_SIZE, v).ptr;
+}
+
+char *NumberFormat::floating(char *out, long double v) noexcept {
+    return std::to_chars(out, out + MAX_SIZE, v).ptr;
+}
+
+} // namespace util
+
+} // namespace nijika
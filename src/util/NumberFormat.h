@@ -0,0 +1,143 @@
+#pragma once
+
+#include <type_traits>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Locale-free number formatting kernels. Integers are written two digits at
+ * a time from a table, after computing their length without a loop, so the
+ * output is written exactly once, back to front, and hexadecimal likewise.
+ * Floating point numbers get the shortest representation that parses back to
+ * the same value.
+ * All functions are reentrant, and write at most MAX_SIZE bytes.
+ */
+class NumberFormat {
+  public:
+    static constexpr size_t MAX_SIZE = 48; // Any number or pointer.
+
+    /**
+     * @return: the number of decimal digits of v, 1 for 0.
+     */
+    static int digits10(uint64_t v) noexcept {
+        v |= 1; // 0 has one digit, like 1.
+        // 1233 / 4096 ~= log10(2), so t is either the number of digits or
+        // one less.
+        int t = (64 - __builtin_clzll(v)) * 1233 >> 12;
+        return t + (v >= POW10[t]);
+    }
+
+    /**
+     * Writes an integer in decimal.
+     * @param out: destination, at least MAX_SIZE bytes.
+     * @param v: the integer.
+     * @return: the end of the output.
+     */
+    template <typename T> static char *integer(char *out, T v) noexcept {
+        static_assert(std::is_integral_v<T>, "Not an integer.");
+        using U = std::make_unsigned_t<T>;
+        U u = (U)v;
+        if constexpr (std::is_signed_v<T>) {
+            if (v < 0) {
+                *out++ = '-';
+                u = (U)0 - u;
+            }
+        }
+        if constexpr (sizeof(U) <= sizeof(uint32_t)) {
+            return decimal(out, (uint32_t)u);
+        } else {
+            return decimal(out, (uint64_t)u);
+        }
+    }
+
+    /**
+     * Writes an integer in lower case hexadecimal, without prefix.
+     * @param out: destination, at least MAX_SIZE bytes.
+     * @param v: the integer.
+     * @return: the end of the output.
+     */
+    static char *hex(char *out, uint64_t v) noexcept {
+        static const char digits[] = "0123456789abcdef";
+
+        int n = (64 - __builtin_clzll(v | 1) + 3) / 4;
+        char *end = out + n;
+        do {
+            *--end = digits[v & 0xf];
+            v >>= 4;
+        } while (end != out);
+        return out + n;
+    }
+
+    /**
+     * Writes a pointer like std::ostream does, 0x-prefixed hexadecimal, or
+     * 0 for nullptr.
+     * @param out: destination, at least MAX_SIZE bytes.
+     * @param p: the pointer value.
+     * @return: the end of the output.
+     */
+    static char *pointer(char *out, uint64_t p) noexcept {
+        if (p == 0) {
+            *out = '0';
+            return out + 1;
+        }
+        out[0] = '0';
+        out[1] = 'x';
+        return hex(out + 2, p);
+    }
+
+    /**
+     * Writes the shortest decimal representation reading back as the same
+     * value, in fixed or scientific notation, whichever is shorter, e.g.
+     * 0.1, 1.5e+300, inf, nan.
+     * @param out: destination, at least MAX_SIZE bytes.
+     * @param v: the number.
+     * @return: the end of the output.
+     */
+    static char *floating(char *out, float v) noexcept;
+    static char *floating(char *out, double v) noexcept;
+    static char *floating(char *out, long double v) noexcept;
+
+  private:
+    static const char DIGIT_PAIRS[201]; // "00" to "99".
+    static const uint64_t POW10[20];    // 1 to 10^19.
+
+    /**
+     * Writes an unsigned integer, uint32_t or uint64_t, whose divisions
+     * are cheaper. Peels four digits per division, the two pairs of which
+     * are independent, so the chain of divisions is half as long.
+     */
+    template <typename U> static char *decimal(char *out, U v) noexcept {
+        char *end = out + digits10(v);
+        char *p = end;
+        while (v >= 10000) {
+            uint32_t r = (uint32_t)(v % 10000);
+            v /= 10000;
+            p -= 4;
+            memcpy(p, &DIGIT_PAIRS[r / 100 * 2], 2);
+            memcpy(p + 2, &DIGIT_PAIRS[r % 100 * 2], 2);
+        }
+        uint32_t w = (uint32_t)v;
+        if (w >= 100) {
+            p -= 2;
+            memcpy(p, &DIGIT_PAIRS[w % 100 * 2], 2);
+            w /= 100;
+        }
+        if (w >= 10) {
+            p -= 2;
+            memcpy(p, &DIGIT_PAIRS[w * 2], 2);
+        } else {
+            *--p = (char)('0' + w);
+        }
+        return end;
+    }
+};
+
+} // namespace util
+
+} // namespace nijika
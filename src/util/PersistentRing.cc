@@ -0,0 +1,179 @@
+#include "PersistentRing.h"
+
+#include <algorithm>
+#include <new>
+#include <system_error>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nijika {
+
+namespace util {
+
+static const char RING_MAGIC[8] = {'N', 'I', 'L', 'O', 'G', 'R', 'N', 'G'};
+
+/**
+ * Beginning of the file, the ring starts at the next page.
+ */
+struct PersistentRing::Header {
+    char magic[8];              // RING_MAGIC, written last.
+    uint64_t capacity;          // Size of the ring.
+    std::atomic<uint64_t> head; // Committed position.
+    std::atomic<uint64_t> tail; // Pushed position.
+};
+
+static size_t round_up_pow2(size_t n) {
+    size_t res = 1;
+    while (res < n) {
+        res <<= 1;
+    }
+    return res;
+}
+
+PersistentRing::PersistentRing(const std::string &path, size_t capacity)
+    : fd_(-1), base_(nullptr), map_size_(0), header_(nullptr),
+      buf_(nullptr), capacity_(0), mask_(0), read_(0) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    capacity_ = round_up_pow2(std::max(capacity, page));
+    mask_ = capacity_ - 1;
+    map_size_ = page + capacity_;
+
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        throw std::system_error(errno, std::generic_category());
+    }
+    // Allocate the blocks now, a store to a hole the disk has no room for
+    // would raise SIGBUS. Not every file system can, ftruncate is enough
+    // then.
+    if (posix_fallocate(fd_, 0, map_size_) != 0 &&
+        ftruncate(fd_, map_size_) != 0) {
+        int err = errno;
+        close(fd_);
+        throw std::system_error(err, std::generic_category());
+    }
+
+    void *ptr = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_, 0);
+    if (ptr == MAP_FAILED) {
+        int err = errno;
+        close(fd_);
+        throw std::system_error(err, std::generic_category());
+    }
+    base_ = (char *)ptr;
+    buf_ = base_ + page;
+
+    // Write to every page, so none is faulted in on the hot path.
+    for (size_t off = page; off < map_size_; off += page) {
+        base_[off] = 0;
+    }
+
+    header_ = new (base_) Header;
+    header_->capacity = capacity_;
+    header_->head.store(0, std::memory_order_relaxed);
+    header_->tail.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->magic, RING_MAGIC, sizeof(RING_MAGIC));
+}
+
+PersistentRing::~PersistentRing() {
+    munmap(base_, map_size_);
+    close(fd_);
+}
+
+std::string PersistentRing::recover(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return std::string();
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return std::string();
+    }
+
+    size_t size = st.st_size;
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        return std::string();
+    }
+
+    std::string res;
+    const char *base = (const char *)ptr;
+    const Header *header = (const Header *)base;
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint64_t capacity = header->capacity;
+    uint64_t head = header->head.load(std::memory_order_acquire);
+    uint64_t tail = header->tail.load(std::memory_order_acquire);
+
+    bool valid = memcmp(header->magic, RING_MAGIC, sizeof(RING_MAGIC)) == 0 &&
+                 capacity != 0 && (capacity & (capacity - 1)) == 0 &&
+                 page + capacity <= size && tail - head <= capacity;
+    if (valid) {
+        const char *buf = base + page;
+        res.reserve(tail - head);
+        for (uint64_t pos = head; pos != tail;) {
+            size_t off = pos & (capacity - 1);
+            size_t n = std::min(tail - pos, capacity - off);
+            res.append(buf + off, n);
+            pos += n;
+        }
+    }
+
+    munmap(ptr, size);
+    return res;
+}
+
+bool PersistentRing::push(const char *data, size_t len) noexcept {
+    uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+
+    if (capacity_ - (tail - head) < len) {
+        return false;
+    }
+
+    size_t off = tail & mask_;
+    size_t first = capacity_ - off;
+    if (first >= len) {
+        memcpy(buf_ + off, data, len);
+    } else {
+        // Wrap around.
+        memcpy(buf_ + off, data, first);
+        memcpy(buf_, data + first, len - first);
+    }
+
+    // Published only once complete, a crash before leaves no trace.
+    header_->tail.store(tail + len, std::memory_order_release);
+    return true;
+}
+
+size_t PersistentRing::peek(const char **data) noexcept {
+    uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    if (tail == read_) {
+        return 0;
+    }
+
+    size_t off = read_ & mask_;
+    size_t n = std::min(tail - read_, (uint64_t)(capacity_ - off));
+    *data = buf_ + off;
+    return n;
+}
+
+void PersistentRing::commit() noexcept {
+    header_->head.store(read_, std::memory_order_release);
+}
+
+size_t PersistentRing::size() const noexcept {
+    uint64_t head = header_->head.load(std::memory_order_acquire);
+    return header_->tail.load(std::memory_order_acquire) - head;
+}
+
+} // namespace util
+
+} // namespace nijika
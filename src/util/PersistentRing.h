@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Noncopyable.h"
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Byte ring in a shared mapping of a file, so the bytes pushed survive a
+ * crash of the process: the kernel owns the pages and writes them back
+ * whatever happens to the process. A small header at the beginning of the
+ * file holds the positions, so a later process finds the bytes pushed but
+ * not yet committed by the consumer, see recover. (A crash of the machine
+ * is not covered.)
+ * Each push is all-or-nothing, so a crash never leaves a partial record
+ * behind.
+ * @thread-safety: safe for one producer and one consumer, concurrent
+ * producers must be serialized by the caller.
+ */
+class PersistentRing : Noncopyable {
+  public:
+    /**
+     * Creates or truncates the file and maps an empty ring over it. Bytes
+     * left in the file are lost, recover them first.
+     * @param path: backing file path.
+     * @param capacity: ring capacity, rounded up to a power of two and a
+     * multiple of page size.
+     * @throw: std::system_error if the file cannot be created or mapped.
+     */
+    PersistentRing(const std::string &path, size_t capacity);
+
+    ~PersistentRing();
+
+    /**
+     * Reads the bytes a previous user of a ring file pushed but did not
+     * commit.
+     * @param path: backing file path.
+     * @return: the bytes in push order, empty if the file does not exist or
+     * does not hold a ring.
+     */
+    static std::string recover(const std::string &path);
+
+    /**
+     * Copies data into the ring. (producer side)
+     * @param data: pointer to the user data.
+     * @param len: size of the data.
+     * @return: false if there is not enough free space.
+     */
+    bool push(const char *data, size_t len) noexcept;
+
+    /**
+     * Gets the longest contiguous region not consumed yet. (consumer side)
+     * @param data: receives a pointer to the region.
+     * @return: size of the region, 0 if everything is consumed.
+     */
+    size_t peek(const char **data) noexcept;
+
+    /**
+     * Marks bytes returned by peek as read. They stay in the ring, and are
+     * still recovered after a crash, until commit. (consumer side)
+     * @param len: number of bytes to consume.
+     */
+    void consume(size_t len) noexcept { read_ += len; }
+
+    /**
+     * Releases the consumed bytes, e.g. once they reached the log file.
+     * (consumer side)
+     */
+    void commit() noexcept;
+
+    /**
+     * @return: the bytes pushed and not committed.
+     */
+    size_t size() const noexcept;
+
+    /**
+     * @return: the free space for push.
+     */
+    size_t avail() const noexcept { return capacity_ - size(); }
+
+    /**
+     * @return: the capacity of the ring.
+     */
+    size_t capacity() const noexcept { return capacity_; }
+
+  private:
+    struct Header;
+
+    int fd_;          // Backing file.
+    char *base_;      // The mapping, the header then the ring.
+    size_t map_size_; // Size of the mapping.
+    Header *header_;  // Positions, at the beginning of the mapping.
+    char *buf_;       // Ring storage.
+    size_t capacity_; // Power of two.
+    size_t mask_;     // capacity_ - 1.
+    uint64_t read_;   // Consumed position. (consumer only)
+};
+
+} // namespace util
+
+} // namespace nijika
@@ -0,0 +1,137 @@
+#include "SeekableLz4.h"
+#include "Lz4.h"
+
+#include <algorithm>
+
+namespace nijika {
+
+namespace util {
+
+static inline uint32_t read_le32(const char *p) {
+    const uint8_t *b = (const uint8_t *)p;
+    return b[0] | b[1] << 8 | b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static inline uint64_t read_le64(const char *p) {
+    return read_le32(p) | (uint64_t)read_le32(p + 4) << 32;
+}
+
+static inline void append_le32(std::string &out, uint32_t v) {
+    char b[4] = {(char)v, (char)(v >> 8), (char)(v >> 16), (char)(v >> 24)};
+    out.append(b, sizeof(b));
+}
+
+static inline void append_le64(std::string &out, uint64_t v) {
+    append_le32(out, (uint32_t)v);
+    append_le32(out, (uint32_t)(v >> 32));
+}
+
+std::string SeekableLz4::index_frame(const std::vector<Frame> &frames) {
+    std::string out;
+    append_le32(out, INDEX_MAGIC);
+    append_le32(out, frames.size() * 16 + 8);
+    for (auto &&frame : frames) {
+        append_le64(out, frame.offset);
+        append_le64(out, frame.raw_offset);
+    }
+    append_le32(out, frames.size());
+    append_le32(out, SEEK_MAGIC);
+    return out;
+}
+
+bool SeekableLz4::load_index(const char *data, size_t len,
+                             std::vector<Frame> &frames, uint64_t *raw_size) {
+    frames.clear();
+
+    // The index sits at the very end, behind the last data frame.
+    size_t index_pos = len;
+    if (len >= 16 && read_le32(data + len - 4) == SEEK_MAGIC) {
+        uint64_t count = read_le32(data + len - 8);
+        uint64_t size = 8 + count * 16 + 8;
+        if (size <= len &&
+            read_le32(data + len - size) == INDEX_MAGIC &&
+            read_le32(data + len - size + 4) == size - 8) {
+            index_pos = len - size;
+            const char *p = data + index_pos + 8;
+            for (uint64_t i = 0; i < count; ++i, p += 16) {
+                frames.push_back({read_le64(p), read_le64(p + 8)});
+            }
+        }
+    }
+
+    if (index_pos != len) {
+        // Only the last frame has to be measured for the total size.
+        *raw_size = 0;
+        if (!frames.empty()) {
+            uint64_t content;
+            const Frame &last = frames.back();
+            if (last.offset >= index_pos ||
+                !Lz4::frame_size(data + last.offset, index_pos - last.offset,
+                                 &content)) {
+                return false;
+            }
+            *raw_size = last.raw_offset + content;
+        }
+        return true;
+    }
+
+    // No index, e.g. the process crashed. Walk the frame headers, a
+    // truncated last frame is ignored.
+    size_t pos = 0;
+    uint64_t raw = 0;
+    while (pos < len) {
+        uint64_t content;
+        size_t n = Lz4::frame_size(data + pos, len - pos, &content);
+        if (n == 0) {
+            break;
+        }
+        if (read_le32(data + pos) == Lz4::FRAME_MAGIC) {
+            frames.push_back({pos, raw});
+            raw += content;
+        }
+        pos += n;
+    }
+
+    *raw_size = raw;
+    return pos > 0 || len == 0;
+}
+
+bool SeekableLz4::read(const char *data, size_t len,
+                       const std::vector<Frame> &frames, uint64_t offset,
+                       uint64_t count, std::string &out) {
+    // The last frame starting at or before offset.
+    auto it = std::upper_bound(
+        frames.begin(), frames.end(), offset,
+        [](uint64_t off, const Frame &frame) { return off < frame.raw_offset; });
+    if (it != frames.begin()) {
+        --it;
+    }
+
+    uint64_t end = count > UINT64_MAX - offset ? UINT64_MAX : offset + count;
+    std::string content;
+    for (; it != frames.end() && it->raw_offset < end; ++it) {
+        if (it->offset >= len) {
+            return false;
+        }
+
+        uint64_t size;
+        size_t n = Lz4::frame_size(data + it->offset, len - it->offset, &size);
+        content.clear();
+        if (n == 0 || !Lz4::decompress_frame(data + it->offset, n, content)) {
+            return false;
+        }
+
+        uint64_t begin = std::max(offset, it->raw_offset) - it->raw_offset;
+        if (begin < content.size()) {
+            uint64_t stop = std::min<uint64_t>(content.size(),
+                                               end - it->raw_offset);
+            out.append(content, begin, stop - begin);
+        }
+    }
+
+    return true;
+}
+
+} // namespace util
+
+} // namespace nijika
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Seekable container of independent LZ4 frames. It is still a valid .lz4
+ * stream: the frame index lives in a trailing skippable frame, which lz4
+ * tools ignore.
+ *
+ * Index frame layout (little endian):
+ *   u32 INDEX_MAGIC, u32 payload size, then the payload:
+ *   {u64 file offset, u64 raw offset} per frame, u32 frame count,
+ *   u32 SEEK_MAGIC.
+ */
+class SeekableLz4 {
+  public:
+    static constexpr uint32_t INDEX_MAGIC = 0x184D2A5E; // A skippable magic.
+    static constexpr uint32_t SEEK_MAGIC = 0x4B53494E;  // "NISK"
+
+    struct Frame {
+        uint64_t offset;     // File offset of the frame.
+        uint64_t raw_offset; // Uncompressed offset of its content.
+    };
+
+    /**
+     * Builds the index frame.
+     * @param frames: frames of the file, in order.
+     */
+    static std::string index_frame(const std::vector<Frame> &frames);
+
+    /**
+     * Loads the frame index of a file. Files that were not closed cleanly
+     * have no index, it is rebuilt from the frame headers then.
+     * @param data: pointer to the file.
+     * @param len: size of the file.
+     * @param frames: receives the frames.
+     * @param raw_size: receives the total uncompressed size.
+     * @return: false if the file is not a valid container.
+     */
+    static bool load_index(const char *data, size_t len,
+                           std::vector<Frame> &frames, uint64_t *raw_size);
+
+    /**
+     * Decompresses a range of the uncompressed content, touching only the
+     * frames that overlap it.
+     * @param data: pointer to the file.
+     * @param len: size of the file.
+     * @param frames: frames from load_index.
+     * @param offset: uncompressed offset of the range.
+     * @param count: size of the range, clamped to the content.
+     * @param out: receives the content.
+     * @return: false if a frame is corrupted.
+     */
+    static bool read(const char *data, size_t len,
+                     const std::vector<Frame> &frames, uint64_t offset,
+                     uint64_t count, std::string &out);
+};
+
+} // namespace util
+
+} // namespace nijika
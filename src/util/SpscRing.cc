@@ -0,0 +1,70 @@
+#include "SpscRing.h"
+
+#include <string.h>
+
+namespace nijika {
+
+namespace util {
+
+static size_t round_up_pow2(size_t n) {
+    size_t res = 1;
+    while (res < n) {
+        res <<= 1;
+    }
+    return res;
+}
+
+SpscRing::SpscRing(size_t capacity)
+    : capacity_(round_up_pow2(capacity)), mask_(capacity_ - 1), head_(0),
+      cached_tail_(0), tail_(0), cached_head_(0) {
+    buf_.reset(new char[capacity_]);
+}
+
+bool SpscRing::push(const char *data, size_t len) noexcept {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+
+    if (capacity_ - (tail - cached_head_) < len) {
+        // Looks full, refresh the consumer's position.
+        cached_head_ = head_.load(std::memory_order_acquire);
+        if (capacity_ - (tail - cached_head_) < len) {
+            return false;
+        }
+    }
+
+    size_t off = tail & mask_;
+    size_t first = capacity_ - off;
+    if (first >= len) {
+        memcpy(buf_.get() + off, data, len);
+    } else {
+        // Wrap around.
+        memcpy(buf_.get() + off, data, first);
+        memcpy(buf_.get(), data + first, len - first);
+    }
+
+    tail_.store(tail + len, std::memory_order_release);
+    return true;
+}
+
+size_t SpscRing::peek(const char **data) noexcept {
+    size_t head = head_.load(std::memory_order_relaxed);
+
+    if (cached_tail_ == head) {
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        if (cached_tail_ == head) {
+            return 0;
+        }
+    }
+
+    size_t off = head & mask_;
+    size_t n = cached_tail_ - head;
+    if (n > capacity_ - off) {
+        n = capacity_ - off;
+    }
+
+    *data = buf_.get() + off;
+    return n;
+}
+
+} // namespace util
+
+} // namespace nijika
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Noncopyable.h"
+
+#include <atomic>
+#include <memory>
+
+namespace nijika {
+
+namespace util {
+
+/**
+ * Lock-free single-producer single-consumer byte ring.
+ * Each push is all-or-nothing, so the consumer never observes a partially
+ * written record.
+ * @thread-safety: safe for exactly one producer and one consumer.
+ */
+class SpscRing : Noncopyable {
+  public:
+    /**
+     * Constructs a ring of specified capacity.
+     * @param capacity: ring capacity, rounded up to a power of two.
+     */
+    explicit SpscRing(size_t capacity);
+
+    /**
+     * Copies data into the ring. (producer side)
+     * @param data: pointer to the user data.
+     * @param len: size of the data.
+     * @return: false if there is not enough free space.
+     */
+    bool push(const char *data, size_t len) noexcept;
+
+    /**
+     * Upper bound of the unread bytes as seen by the producer, without
+     * touching the consumer's cache line. (producer side)
+     */
+    size_t backlog() const noexcept {
+        return tail_.load(std::memory_order_relaxed) - cached_head_;
+    }
+
+    /**
+     * Gets the longest contiguous readable region. (consumer side)
+     * @param data: receives a pointer to the region.
+     * @return: size of the region, 0 if the ring is empty.
+     */
+    size_t peek(const char **data) noexcept;
+
+    /**
+     * Releases bytes returned by peek. (consumer side)
+     * @param len: number of bytes to release.
+     */
+    void consume(size_t len) noexcept {
+        head_.store(head_.load(std::memory_order_relaxed) + len,
+                    std::memory_order_release);
+    }
+
+    /**
+     * @return: true if the ring holds no unread bytes.
+     */
+    bool empty() const noexcept {
+        return head_.load(std::memory_order_acquire) ==
+               tail_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @return: the capacity of the ring.
+     */
+    size_t capacity() const noexcept { return capacity_; }
+
+  private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::unique_ptr<char[]> buf_; // Ring storage.
+    size_t capacity_;             // Power of two.
+    size_t mask_;                 // capacity_ - 1.
+
+    alignas(CACHE_LINE) std::atomic<size_t> head_; // Read position.
+    size_t cached_tail_;                           // Consumer's view of tail.
+
+    alignas(CACHE_LINE) std::atomic<size_t> tail_; // Write position.
+    size_t cached_head_;                           // Producer's view of head.
+};
+
+} // namespace util
+
+} // namespace nijika
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <string>
 
+#include <string.h>
 #include <time.h>
 
 namespace nijika {
@@ -30,6 +31,128 @@ std::string to_formatted_string(const std::string &fmt,
     return ans;
 }
 
+/**
+ * Formats "YYYY-MM-DD HH:MM:SS.uuuuuu" timestamps. The date and time part is
+ * cached per second, so only the microsecond digits are rendered per call.
+ * @thread-safety: unsafe, keep one instance per thread.
+ */
+class TimestampFormatter {
+  public:
+    static constexpr size_t LENGTH = 26; // Size of a formatted timestamp.
+
+    /**
+     * LOCAL: system time zone, looked up once per second.
+     * UTC: no time zone lookup at all.
+     * FIXED: UTC plus a fixed offset, no time zone lookup at all.
+     */
+    enum zone { LOCAL = 0, UTC, FIXED };
+
+    TimestampFormatter() noexcept
+        : zone_(LOCAL), offset_(0), cached_sec_(-1) {}
+
+    /**
+     * Formats a timestamp. Writes exactly LENGTH bytes, no null terminator.
+     * @param out: destination, at least LENGTH bytes.
+     * @param tp: time point to format.
+     * @param zone: time zone of the output.
+     * @param offset: offset from UTC in seconds. (only used by FIXED)
+     */
+    void format(char *out, std::chrono::system_clock::time_point tp,
+                zone zone = LOCAL, long offset = 0) noexcept {
+        using namespace std::chrono;
+        long long us =
+            duration_cast<microseconds>(tp.time_since_epoch()).count();
+        time_t sec = us / 1000000;
+        long usec = us % 1000000;
+        if (usec < 0) {
+            sec -= 1;
+            usec += 1000000;
+        }
+
+        if (sec != cached_sec_ || zone != zone_ || offset != offset_) {
+            rebuild(sec, zone, offset);
+        }
+
+        memcpy(out, cached_, PREFIX_LENGTH);
+        for (int i = LENGTH - 1; i >= (int)PREFIX_LENGTH; --i) {
+            out[i] = '0' + usec % 10;
+            usec /= 10;
+        }
+    }
+
+  private:
+    static constexpr size_t PREFIX_LENGTH = 20; // "YYYY-MM-DD HH:MM:SS."
+
+    zone zone_;                  // Zone of the cached prefix.
+    long offset_;                // Offset of the cached prefix.
+    time_t cached_sec_;          // Second of the cached prefix.
+    char cached_[PREFIX_LENGTH]; // Cached prefix.
+
+    static void put2(char *out, int v) noexcept {
+        out[0] = '0' + v / 10;
+        out[1] = '0' + v % 10;
+    }
+
+    void rebuild(time_t sec, zone zone, long offset) noexcept {
+        tm tm;
+        if (zone == LOCAL) {
+            localtime_r(&sec, &tm);
+        } else {
+            civil_time(sec + (zone == FIXED ? offset : 0), &tm);
+        }
+
+        int year = tm.tm_year + 1900;
+        put2(cached_, year / 100 % 100);
+        put2(cached_ + 2, year % 100);
+        cached_[4] = '-';
+        put2(cached_ + 5, tm.tm_mon + 1);
+        cached_[7] = '-';
+        put2(cached_ + 8, tm.tm_mday);
+        cached_[10] = ' ';
+        put2(cached_ + 11, tm.tm_hour);
+        cached_[13] = ':';
+        put2(cached_ + 14, tm.tm_min);
+        cached_[16] = ':';
+        put2(cached_ + 17, tm.tm_sec);
+        cached_[19] = '.';
+
+        zone_ = zone;
+        offset_ = offset;
+        cached_sec_ = sec;
+    }
+
+    /**
+     * Converts seconds since epoch to UTC calendar time without any time
+     * zone lookup. (Howard Hinnant's civil_from_days)
+     */
+    static void civil_time(long long sec, tm *tm) noexcept {
+        long long days = sec / 86400;
+        long long rem = sec % 86400;
+        if (rem < 0) {
+            rem += 86400;
+            days -= 1;
+        }
+
+        tm->tm_hour = rem / 3600;
+        tm->tm_min = rem % 3600 / 60;
+        tm->tm_sec = rem % 60;
+
+        days += 719468;
+        long long era = (days >= 0 ? days : days - 146096) / 146097;
+        unsigned doe = days - era * 146097;
+        unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        unsigned mp = (5 * doy + 2) / 153;
+        unsigned d = doy - (153 * mp + 2) / 5 + 1;
+        unsigned m = mp < 10 ? mp + 3 : mp - 9;
+        long long y = yoe + era * 400 + (m <= 2);
+
+        tm->tm_year = y - 1900;
+        tm->tm_mon = m - 1;
+        tm->tm_mday = d;
+    }
+};
+
 } // namespace util
 
 } // namespace nijika
\ No newline at end of file
@@ -1,5 +1,7 @@
 add_rules("mode.debug", "mode.release")
 
+set_languages("c++17")
+
 add_includedirs("src")
 add_includedirs("include")
 
@@ -15,6 +17,54 @@ target("test")
     set_targetdir("build/bin")
     add_deps("nilog")
 
+target("nilog-decode")
+    set_kind("binary")
+    add_files("src/decode/*.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-cat")
+    set_kind("binary")
+    add_files("src/cat/*.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-merge")
+    set_kind("binary")
+    add_files("src/merge/*.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-recover")
+    set_kind("binary")
+    add_files("src/recover/*.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("bench")
+    set_kind("binary")
+    add_files("src/bench/main.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-bench-seekable")
+    set_kind("binary")
+    add_files("src/bench/seekable.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-bench-shards")
+    set_kind("binary")
+    add_files("src/bench/shards.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
+target("nilog-bench-format")
+    set_kind("binary")
+    add_files("src/bench/format.cc")
+    set_targetdir("build/bin")
+    add_deps("nilog")
+
 --
 -- If you want to known more usage about xmake, please see https://xmake.io
 --